@@ -17,20 +17,28 @@
 #include <fontconfig/fontconfig.h>
 
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <spawn.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 // hack
 #define ENTRIES_FILE "/etc/xlunch/entries.dsv"
-#define MAX_APPS 512
 #define MAX_LABEL 256
 #define FILTER_MAX 128
 
@@ -39,6 +47,11 @@
 #define CELL_PAD_H 24
 #define CELL_PAD_TOP 8
 
+#define ATLAS_COLS 16 /* icons per atlas page row */
+#define ATLAS_ROWS 16
+
+#define WORKER_THREADS_MAX 4
+
 #define ANIM_STEPS 20
 #define ANIM_TOTAL_MS 200
 
@@ -46,10 +59,18 @@ typedef struct {
   char name[MAX_LABEL];
   char icon_path[512];
   char cmd[512];
-  Pixmap icon_pixmap;
-  Picture icon_picture;
-  unsigned icon_w, icon_h;
+  uint64_t icon_hash; /* path_hash(icon_path), 0 = no icon */
+  int icon_slot;  /* cell in the icon atlas, -1 = none */
+  int icon_tried; /* decoded on first display, not at startup */
   int valid;
+  uint32_t frecency; /* from the launch history */
+  uint32_t label_gen; /* layout below is for this label_gen, 0 = none */
+  int label_len;      /* bytes of name shown, "..." follows if short */
+  int label_w;        /* pixel width, -1 = nothing fits */
+  uint64_t source; /* 0: ENTRIES_FILE, else hash of the desktop file id */
+  int line;        /* position in ENTRIES_FILE */
+  char id[256];    /* desktop file id */
+  int seen;        /* scratch for reload_entries_file() */
 } App;
 
 typedef struct {
@@ -61,7 +82,9 @@ typedef struct {
   XftColor xft_color_dim;
   FT_Library ft_lib;
   FT_Face ft_face;
-  Picture win_picture;
+  Pixmap frame; /* everything is drawn here, then copied to win */
+  Picture frame_picture;
+  GC gc;
   Pixmap bg_pixmap;
   Picture bg_picture;
   unsigned bg_w, bg_h;
@@ -77,8 +100,9 @@ static int depth;
 static Overlay *overlays = NULL;
 static int overlay_count = 0;
 
-static App apps[MAX_APPS];
-static int app_count = 0;
+static App *apps = NULL;
+static int app_count = 0, app_cap = 0;
+static int *match_buf = NULL; /* app_cap entries, filled by build_matches */
 
 static char filter_text[FILTER_MAX] = {0};
 static int filter_len = 0;
@@ -86,6 +110,11 @@ static int filter_len = 0;
 static int selected_index = 0;
 static int scroll_row = 0;
 static int overlay_visible = 0;
+/* the frames hold the unfiltered first page, ready to be shown */
+static int first_frame_valid = 0;
+/* set when the monitor layout changed: the root was resized, or the
+   Xinerama screens differ from the ones the overlays were built for */
+static int layout_dirty = 0;
 
 /* shared background, loaded once */
 static Pixmap shared_bg_pixmap = 0;
@@ -127,13 +156,13 @@ static void animate_shrink(void) {
   }
 }
 
-static void draw_gradient_border(int w, int h, Display *dpy, Window win) {
+static void draw_gradient_border(int w, int h, Display *dpy, Drawable d) {
   if (w <= 1 || h <= 1)
     return;
   XRenderPictFormat *fmt = XRenderFindStandardFormat(dpy, PictStandardARGB32);
   if (!fmt)
     return;
-  Picture dst = XRenderCreatePicture(dpy, win, fmt, 0, NULL);
+  Picture dst = XRenderCreatePicture(dpy, d, fmt, 0, NULL);
   XFixed stops[2] = {XDoubleToFixed(0.0), XDoubleToFixed(1.0)};
   XRenderColor bw[2] = {{0, 0, 0, 0xffff}, {0xffff, 0xffff, 0xffff, 0xffff}};
   XRenderColor wb[2] = {{0xffff, 0xffff, 0xffff, 0xffff}, {0, 0, 0, 0xffff}};
@@ -212,18 +241,18 @@ static XftFont *xft_font_from_memory(Display *dpy, int screen,
   return xf;
 }
 
-static Pixmap load_png_to_pixmap_from_file(Display *dpy, Drawable root,
-                                           const char *path, unsigned *out_w,
-                                           unsigned *out_h) {
+/* decode a PNG file into premultiplied ARGB32; the caller frees it */
+static uint32_t *decode_png_file(const char *path, unsigned *out_w,
+                                 unsigned *out_h) {
   FILE *fp = fopen(path, "rb");
   if (!fp)
-    return 0;
+    return NULL;
   png_image im;
   memset(&im, 0, sizeof im);
   im.version = PNG_IMAGE_VERSION;
   if (!png_image_begin_read_from_stdio(&im, fp)) {
     fclose(fp);
-    return 0;
+    return NULL;
   }
   im.format = PNG_FORMAT_RGBA;
   size_t sz = PNG_IMAGE_SIZE(im);
@@ -231,13 +260,13 @@ static Pixmap load_png_to_pixmap_from_file(Display *dpy, Drawable root,
   if (!rgba) {
     png_image_free(&im);
     fclose(fp);
-    return 0;
+    return NULL;
   }
   if (!png_image_finish_read(&im, NULL, rgba, 0, NULL)) {
     free(rgba);
     png_image_free(&im);
     fclose(fp);
-    return 0;
+    return NULL;
   }
   fclose(fp);
 
@@ -246,7 +275,7 @@ static Pixmap load_png_to_pixmap_from_file(Display *dpy, Drawable root,
   if (!argb) {
     free(rgba);
     png_image_free(&im);
-    return 0;
+    return NULL;
   }
   for (size_t i = 0, n = (size_t)w * h; i < n; ++i) {
     uint8_t r = rgba[4 * i + 0], g = rgba[4 * i + 1], b = rgba[4 * i + 2],
@@ -260,46 +289,37 @@ static Pixmap load_png_to_pixmap_from_file(Display *dpy, Drawable root,
   free(rgba);
   png_image_free(&im);
 
-  int fmt_count = 0;
-  XPixmapFormatValues *pf = XListPixmapFormats(dpy, &fmt_count);
-  int has32 = 0;
-  for (int i = 0; i < fmt_count; ++i)
-    if (pf[i].depth == 32) {
-      has32 = 1;
-      break;
-    }
-  if (pf)
-    XFree(pf);
-  if (!has32) {
-    free(argb);
-    return 0;
-  }
-
-  Pixmap pix = XCreatePixmap(dpy, root, w, h, 32);
-  if (!pix) {
-    free(argb);
-    return 0;
-  }
+  *out_w = w;
+  *out_h = h;
+  return argb;
+}
 
-  XImage *xi = XCreateImage(dpy, DefaultVisual(dpy, DefaultScreen(dpy)), 32,
-                            ZPixmap, 0, (char *)argb, w, h, 32, 0);
-  if (!xi) {
-    XFreePixmap(dpy, pix);
-    free(argb);
-    return 0;
+/* box-filter premultiplied pixels down (or up) to ICON_SIZE x ICON_SIZE */
+static void scale_to_icon(const uint32_t *src, unsigned sw, unsigned sh,
+                          uint32_t *dst) {
+  for (unsigned y = 0; y < ICON_SIZE; ++y) {
+    unsigned y0 = y * sh / ICON_SIZE, y1 = (y + 1) * sh / ICON_SIZE;
+    if (y1 <= y0)
+      y1 = y0 + 1;
+    for (unsigned x = 0; x < ICON_SIZE; ++x) {
+      unsigned x0 = x * sw / ICON_SIZE, x1 = (x + 1) * sw / ICON_SIZE;
+      if (x1 <= x0)
+        x1 = x0 + 1;
+      uint32_t a = 0, r = 0, g = 0, b = 0, n = 0;
+      for (unsigned sy = y0; sy < y1; ++sy) {
+        for (unsigned sx = x0; sx < x1; ++sx) {
+          uint32_t p = src[(size_t)sy * sw + sx];
+          a += p >> 24;
+          r += (p >> 16) & 0xff;
+          g += (p >> 8) & 0xff;
+          b += p & 0xff;
+          n++;
+        }
+      }
+      dst[y * ICON_SIZE + x] =
+          (a / n) << 24 | (r / n) << 16 | (g / n) << 8 | (b / n);
+    }
   }
-  xi->byte_order = ImageByteOrder(dpy);
-
-  GC gc = XCreateGC(dpy, pix, 0, NULL);
-  XPutImage(dpy, pix, gc, xi, 0, 0, 0, 0, w, h);
-  XFreeGC(dpy, gc);
-  XDestroyImage(xi);
-
-  if (out_w)
-    *out_w = w;
-  if (out_h)
-    *out_h = h;
-  return pix;
 }
 
 static Pixmap load_png_to_pixmap_from_mem(Display *dpy, Drawable root,
@@ -380,6 +400,289 @@ static Picture picture_from_pixmap(Pixmap pix) {
   return XRenderCreatePicture(dpy, pix, fmt, 0, NULL);
 }
 
+/* ---------- icon cache ---------- */
+
+/* every icon is kept on disk already scaled to ICON_SIZE and premultiplied,
+   in one file that is mmap'd at startup, so showing an icon is an
+   XPutImage straight from the mapping instead of a PNG decode. Records are
+   keyed by path and validated against the file's mtime and size; a stale
+   record is rebuilt in place */
+#define ICON_CACHE_MAGIC 0x3163696bU /* "kic1" */
+
+typedef struct {
+  uint32_t magic;
+  uint32_t icon_size;
+  uint32_t count;
+  uint32_t cap;
+} IconCacheHeader;
+
+typedef struct {
+  uint64_t path_hash;
+  int64_t mtime_sec, mtime_nsec;
+  uint64_t size;
+  uint32_t ok; /* 0: the PNG could not be decoded */
+  uint32_t pad;
+  uint32_t argb[ICON_SIZE * ICON_SIZE];
+} IconRecord;
+
+static int icache_fd = -1;
+static IconCacheHeader *icache = NULL;
+static size_t icache_len = 0;
+static uint32_t *icache_tab = NULL; /* record index + 1, 0 = empty */
+static size_t icache_tab_cap = 0;
+
+static IconRecord *icache_rec(uint32_t i) {
+  return (IconRecord *)(icache + 1) + i;
+}
+
+static uint64_t path_hash(const char *s) {
+  uint64_t h = 14695981039346656037ull;
+  for (; *s; ++s)
+    h = (h ^ (unsigned char)*s) * 1099511628211ull;
+  return h;
+}
+
+static void mkdir_parents(char *path) {
+  for (char *p = path + 1; *p; ++p) {
+    if (*p != '/')
+      continue;
+    *p = 0;
+    mkdir(path, 0700);
+    *p = '/';
+  }
+}
+
+/* build $<env>/x11kickstart/<name>, falling back to ~/<fallback>;
+   returns 0 without a home */
+static int xdg_path(char *buf, size_t bufsz, const char *env,
+                    const char *fallback, const char *name) {
+  const char *xdg = getenv(env);
+  const char *home = getenv("HOME");
+  if (xdg && xdg[0])
+    snprintf(buf, bufsz, "%s/x11kickstart/%s", xdg, name);
+  else if (home && home[0])
+    snprintf(buf, bufsz, "%s/%s/x11kickstart/%s", home, fallback, name);
+  else
+    return 0;
+  mkdir_parents(buf);
+  return 1;
+}
+
+static int cache_path(char *buf, size_t bufsz, const char *name) {
+  return xdg_path(buf, bufsz, "XDG_CACHE_HOME", ".cache", name);
+}
+
+static int state_path(char *buf, size_t bufsz, const char *name) {
+  return xdg_path(buf, bufsz, "XDG_STATE_HOME", ".local/state", name);
+}
+
+static void icache_tab_insert(uint32_t i) {
+  size_t mask = icache_tab_cap - 1;
+  size_t k = icache_rec(i)->path_hash & mask;
+  while (icache_tab[k])
+    k = (k + 1) & mask;
+  icache_tab[k] = i + 1;
+}
+
+static void icache_rehash(void) {
+  size_t cap = 64;
+  while (cap < 2 * (size_t)icache->cap)
+    cap *= 2;
+  free(icache_tab);
+  icache_tab = calloc(cap, sizeof(uint32_t));
+  if (!icache_tab)
+    exit(2);
+  icache_tab_cap = cap;
+  for (uint32_t i = 0; i < icache->count; ++i)
+    icache_tab_insert(i);
+}
+
+/* (re)map the file with room for cap records */
+static int icache_map(uint32_t cap) {
+  size_t len = sizeof(IconCacheHeader) + (size_t)cap * sizeof(IconRecord);
+  if (ftruncate(icache_fd, len) < 0)
+    return 0;
+  void *m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, icache_fd, 0);
+  if (m == MAP_FAILED)
+    return 0;
+  if (icache)
+    munmap(icache, icache_len);
+  icache = m;
+  icache_len = len;
+  icache->cap = cap;
+  return 1;
+}
+
+static void icache_open(void) {
+  char path[512];
+  if (!cache_path(path, sizeof(path), "icons"))
+    return;
+  icache_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (icache_fd < 0)
+    return;
+  struct stat st;
+  IconCacheHeader hdr = {0};
+  if (fstat(icache_fd, &st) == 0 && st.st_size >= (off_t)sizeof(hdr) &&
+      pread(icache_fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+      hdr.magic == ICON_CACHE_MAGIC && hdr.icon_size == ICON_SIZE &&
+      hdr.count <= hdr.cap &&
+      (size_t)st.st_size >=
+          sizeof(hdr) + (size_t)hdr.cap * sizeof(IconRecord)) {
+    if (!icache_map(hdr.cap))
+      goto fail;
+  } else {
+    if (ftruncate(icache_fd, 0) < 0 || !icache_map(64))
+      goto fail;
+    icache->magic = ICON_CACHE_MAGIC;
+    icache->icon_size = ICON_SIZE;
+    icache->count = 0;
+  }
+  icache_rehash();
+  return;
+fail:
+  close(icache_fd);
+  icache_fd = -1;
+}
+
+static IconRecord *icache_find(uint64_t hash) {
+  if (!icache)
+    return NULL;
+  size_t mask = icache_tab_cap - 1;
+  for (size_t k = hash & mask; icache_tab[k]; k = (k + 1) & mask) {
+    IconRecord *r = icache_rec(icache_tab[k] - 1);
+    if (r->path_hash == hash)
+      return r;
+  }
+  return NULL;
+}
+
+static int icache_fresh(const IconRecord *r, const struct stat *st) {
+  return r && r->mtime_sec == st->st_mtim.tv_sec &&
+         r->mtime_nsec == st->st_mtim.tv_nsec &&
+         r->size == (uint64_t)st->st_size;
+}
+
+/* store a freshly scaled icon (NULL: undecodable), reusing a stale record */
+static void icache_put(uint64_t hash, const struct stat *st,
+                       const uint32_t *argb) {
+  if (!icache)
+    return;
+  IconRecord *r = icache_find(hash);
+  if (!r) {
+    if (icache->count == icache->cap) {
+      if (!icache_map(icache->cap * 2))
+        return;
+      icache_rehash();
+    }
+    r = icache_rec(icache->count);
+    r->path_hash = hash;
+    icache_tab_insert(icache->count++);
+  }
+  r->mtime_sec = st->st_mtim.tv_sec;
+  r->mtime_nsec = st->st_mtim.tv_nsec;
+  r->size = st->st_size;
+  r->ok = argb != NULL;
+  if (argb)
+    memcpy(r->argb, argb, sizeof(r->argb));
+}
+
+/* ---------- icon atlas ---------- */
+
+/* all icons live in a few atlas pixmaps of ATLAS_COLS x ATLAS_ROWS cells;
+   a cell is drawn with a plain sub-rectangle composite, so there is no
+   per-icon Picture and no transform or filter change per draw */
+static Pixmap *atlas_pixmaps = NULL;
+static Picture *atlas_pictures = NULL;
+static int atlas_pages = 0;
+static int atlas_used = 0;
+static int *atlas_refs = NULL; /* apps showing each cell */
+static int *atlas_free = NULL; /* cells released by removed apps */
+static int atlas_free_count = 0, atlas_free_cap = 0;
+static GC atlas_gc = 0;
+
+static void atlas_cell(int slot, Picture *pic, int *x, int *y) {
+  int per_page = ATLAS_COLS * ATLAS_ROWS;
+  int cell = slot % per_page;
+  *pic = atlas_pictures[slot / per_page];
+  *x = (cell % ATLAS_COLS) * ICON_SIZE;
+  *y = (cell / ATLAS_COLS) * ICON_SIZE;
+}
+
+/* servers without depth-32 pixmaps get no icons, just the placeholder */
+static int have_argb_pixmaps(void) {
+  static int has32 = -1;
+  if (has32 >= 0)
+    return has32;
+  int fmt_count = 0;
+  XPixmapFormatValues *pf = XListPixmapFormats(dpy, &fmt_count);
+  has32 = 0;
+  for (int i = 0; i < fmt_count; ++i)
+    if (pf[i].depth == 32) {
+      has32 = 1;
+      break;
+    }
+  if (pf)
+    XFree(pf);
+  if (!XRenderFindStandardFormat(dpy, PictStandardARGB32))
+    has32 = 0;
+  return has32;
+}
+
+static void atlas_ref(int slot) {
+  atlas_refs[slot]++;
+}
+
+static void atlas_release(int slot) {
+  if (slot < 0 || --atlas_refs[slot] > 0)
+    return;
+  if (atlas_free_count == atlas_free_cap) {
+    atlas_free_cap = atlas_free_cap ? atlas_free_cap * 2 : 64;
+    atlas_free = realloc(atlas_free, atlas_free_cap * sizeof(int));
+    if (!atlas_free)
+      exit(2);
+  }
+  atlas_free[atlas_free_count++] = slot;
+}
+
+/* copy an ICON_SIZE ARGB32 icon into a free cell; returns the slot */
+static int atlas_insert(const uint32_t *argb) {
+  int per_page = ATLAS_COLS * ATLAS_ROWS;
+  if (!have_argb_pixmaps())
+    return -1;
+  if (!atlas_free_count && atlas_used == atlas_pages * per_page) {
+    atlas_pixmaps = realloc(atlas_pixmaps, (atlas_pages + 1) * sizeof(Pixmap));
+    atlas_pictures =
+        realloc(atlas_pictures, (atlas_pages + 1) * sizeof(Picture));
+    atlas_refs =
+        realloc(atlas_refs, (atlas_pages + 1) * per_page * sizeof(int));
+    if (!atlas_pixmaps || !atlas_pictures || !atlas_refs)
+      exit(2);
+    Pixmap pix = XCreatePixmap(dpy, root, ATLAS_COLS * ICON_SIZE,
+                               ATLAS_ROWS * ICON_SIZE, 32);
+    if (!atlas_gc)
+      atlas_gc = XCreateGC(dpy, pix, 0, NULL);
+    atlas_pixmaps[atlas_pages] = pix;
+    atlas_pictures[atlas_pages] = picture_from_pixmap(pix);
+    atlas_pages++;
+  }
+
+  XImage *xi = XCreateImage(dpy, DefaultVisual(dpy, DefaultScreen(dpy)), 32,
+                            ZPixmap, 0, (char *)argb, ICON_SIZE, ICON_SIZE,
+                            32, 0);
+  if (!xi)
+    return -1;
+  xi->byte_order = ImageByteOrder(dpy);
+  int slot = atlas_free_count ? atlas_free[--atlas_free_count] : atlas_used++;
+  int cell = slot % per_page;
+  XPutImage(dpy, atlas_pixmaps[slot / per_page], atlas_gc, xi, 0, 0,
+            (cell % ATLAS_COLS) * ICON_SIZE, (cell / ATLAS_COLS) * ICON_SIZE,
+            ICON_SIZE, ICON_SIZE);
+  xi->data = NULL; /* the pixels belong to the caller */
+  XDestroyImage(xi);
+  atlas_refs[slot] = 1;
+  return slot;
+}
+
 static void trim_newline(char *s) {
   char *p = strchr(s, '\n');
   if (p)
@@ -432,263 +735,1639 @@ static void parse_dsv_line(const char *line, char *name, char *icon,
   }
 }
 
+static App *add_app(const char *name, const char *icon, const char *cmd) {
+  if (app_count == app_cap) {
+    app_cap = app_cap ? app_cap * 2 : 256;
+    apps = realloc(apps, app_cap * sizeof(App));
+    match_buf = realloc(match_buf, app_cap * sizeof(int));
+    if (!apps || !match_buf)
+      exit(2);
+  }
+  App *a = &apps[app_count++];
+  memset(a, 0, sizeof(*a));
+  a->icon_slot = -1;
+  strncpy(a->name, name, sizeof(a->name) - 1);
+  strncpy(a->icon_path, icon, sizeof(a->icon_path) - 1);
+  strncpy(a->cmd, cmd, sizeof(a->cmd) - 1);
+  a->icon_hash = a->icon_path[0] ? path_hash(a->icon_path) : 0;
+  a->valid = 1;
+  return a;
+}
+
 static void load_apps_from_file(void) {
   FILE *f = fopen(ENTRIES_FILE, "r");
   if (!f)
     return;
   char line[1024];
-  while (fgets(line, sizeof(line), f) && app_count < MAX_APPS) {
+  int n = 0;
+  while (fgets(line, sizeof(line), f)) {
     if (line[0] == '#' || line[0] == 0)
       continue;
     char name[MAX_LABEL], icon[512], cmd[512];
     parse_dsv_line(line, name, icon, cmd);
     if (!name[0] || !cmd[0])
       continue;
-    App *a = &apps[app_count];
-    memset(a, 0, sizeof(*a));
-    strncpy(a->name, name, sizeof(a->name) - 1);
-    strncpy(a->icon_path, icon, sizeof(a->icon_path) - 1);
-    strncpy(a->cmd, cmd, sizeof(a->cmd) - 1);
-    if (icon[0]) {
-      a->icon_pixmap = load_png_to_pixmap_from_file(dpy, root, icon,
-                                                    &a->icon_w, &a->icon_h);
-      if (a->icon_pixmap)
-        a->icon_picture = picture_from_pixmap(a->icon_pixmap);
-    }
-    a->valid = 1;
-    app_count++;
+    add_app(name, icon, cmd)->line = n++;
   }
   fclose(f);
 }
 
-static void set_font(Overlay *ov) {
-  if (!FcInit())
-    exit(2);
-  ov->xft_font =
-      xft_font_from_memory(dpy, screen, verdana_ttf, (size_t)verdana_ttf_len,
-                           10.0, &ov->ft_lib, &ov->ft_face);
-  if (!ov->xft_font)
-    exit(2);
-  XWindowAttributes wa;
-  XGetWindowAttributes(dpy, ov->win, &wa);
-  ov->xft_draw = XftDrawCreate(dpy, ov->win, wa.visual, wa.colormap);
-  if (!ov->xft_draw)
-    exit(2);
-  if (!XftColorAllocName(dpy, wa.visual, wa.colormap, "white",
-                         &ov->xft_color_text))
-    exit(2);
-  if (!XftColorAllocName(dpy, wa.visual, wa.colormap, "gray80",
-                         &ov->xft_color_dim))
-    exit(2);
-  XRenderPictFormat *dst_fmt = XRenderFindVisualFormat(dpy, visual);
-  if (dst_fmt)
-    ov->win_picture = XRenderCreatePicture(dpy, ov->win, dst_fmt, 0, NULL);
-  ov->bg_pixmap = shared_bg_pixmap;
-  ov->bg_picture = shared_bg_picture;
-  ov->bg_w = shared_bg_w;
-  ov->bg_h = shared_bg_h;
+static int worker_count(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1)
+    n = 1;
+  if (n > WORKER_THREADS_MAX)
+    n = WORKER_THREADS_MAX;
+  return (int)n;
 }
 
-static void create_overlays(void) {
-  int event_base, error_base;
-  int screens = 1;
-  XineramaScreenInfo *info = NULL;
-  if (XineramaQueryExtension(dpy, &event_base, &error_base) &&
-      XineramaIsActive(dpy)) {
-    info = XineramaQueryScreens(dpy, &screens);
-  }
+/* ---------- XDG desktop entries ---------- */
 
-  int min_w = DisplayWidth(dpy, screen);
-  int min_h = DisplayHeight(dpy, screen);
-  if (info) {
-    min_w = info[0].width;
-    min_h = info[0].height;
-    for (int i = 1; i < screens; ++i) {
-      if (info[i].width < min_w)
-        min_w = info[i].width;
-      if (info[i].height < min_h)
-        min_h = info[i].height;
-    }
-  }
+/* applications are also read from the applications/ directory of every XDG
+   data dir. The .desktop files are parsed in parallel and the result is
+   kept in a binary index together with the mtime of every directory that
+   was scanned; while none of them changed, startup only reads the index */
+#define DESKTOP_INDEX_MAGIC 0x3169646bU /* "kdi1" */
+#define DESKTOP_DEPTH_MAX 4
 
-  overlay_count = screens;
-  overlays = calloc(screens, sizeof(Overlay));
-  for (int i = 0; i < screens; ++i) {
-    int sw = (info ? info[i].width : DisplayWidth(dpy, screen));
-    int sh = (info ? info[i].height : DisplayHeight(dpy, screen));
-    int sx = (info ? info[i].x_org : 0);
-    int sy = (info ? info[i].y_org : 0);
-    int w = (int)(min_w * 0.5);  /* was 0.3 */
-    int h = (int)(min_h * 0.5);  /* was 0.3 */
-    int x = sx + (sw - w) / 2;
-    int y = sy + (sh - h) / 2;
+typedef struct {
+  char path[512];
+  int64_t mtime_sec, mtime_nsec; /* -1: missing */
+  int top; /* an applications/ dir itself rather than a subdirectory */
+} DesktopDir;
 
-    XSetWindowAttributes attr = {0};
-    attr.override_redirect = True;
-    attr.colormap = colormap;
-    attr.border_pixel = 0;
-    attr.background_pixel = 0;
-    attr.event_mask = ExposureMask | KeyPressMask | StructureNotifyMask;
-    Window win =
-        XCreateWindow(dpy, root, x, y, w, h, 0, depth, InputOutput, visual,
-                      CWOverrideRedirect | CWColormap | CWBorderPixel |
-                          CWBackPixel | CWEventMask,
-                      &attr);
-    XSetWindowBackgroundPixmap(dpy, win, None);
+typedef struct {
+  char path[512];
+  char id[256]; /* desktop file id: path below applications/, '/' -> '-' */
+  int order;    /* position in the search path; the first id wins */
+  int shown;
+  char name[MAX_LABEL];
+  char icon[512];
+  char cmd[512];
+} DesktopFile;
 
-    overlays[i].win = win;
-    overlays[i].x = x;
-    overlays[i].y = y;
-    overlays[i].w = w;
-    overlays[i].h = h;
+typedef struct {
+  uint32_t magic, ndirs, nentries, strings_len;
+} DesktopIndexHeader;
 
-    set_font(&overlays[i]);
+typedef struct {
+  int64_t mtime_sec, mtime_nsec;
+  uint32_t path, top; /* path is an offset into the string table */
+} DesktopIndexDir;
+
+typedef struct {
+  uint32_t name, icon, cmd, id;
+} DesktopIndexEntry;
+
+static DesktopDir *ddirs = NULL;
+static int ddir_count = 0, ddir_cap = 0;
+static DesktopFile *dfiles = NULL;
+static int dfile_count = 0, dfile_cap = 0;
+static atomic_int dfile_next;
+
+static void stat_mtime(const char *path, int64_t *sec, int64_t *nsec) {
+  struct stat st;
+  if (stat(path, &st) == 0) {
+    *sec = st.st_mtim.tv_sec;
+    *nsec = st.st_mtim.tv_nsec;
+  } else {
+    *sec = *nsec = -1;
   }
-  if (info)
-    XFree(info);
 }
 
-static void show_overlays(void) {
-  create_overlays();
-  for (int i = 0; i < overlay_count; ++i)
-    XMapRaised(dpy, overlays[i].win);
-  XGrabKeyboard(dpy, root, True, GrabModeAsync, GrabModeAsync, CurrentTime);
-  overlay_visible = 1;
-  selected_index = 0;
-  scroll_row = 0;
+static void add_desktop_dir(const char *path, int top) {
+  if (ddir_count == ddir_cap) {
+    ddir_cap = ddir_cap ? ddir_cap * 2 : 16;
+    ddirs = realloc(ddirs, ddir_cap * sizeof(DesktopDir));
+    if (!ddirs)
+      exit(2);
+  }
+  DesktopDir *d = &ddirs[ddir_count++];
+  snprintf(d->path, sizeof(d->path), "%s", path);
+  d->top = top;
+  stat_mtime(path, &d->mtime_sec, &d->mtime_nsec);
 }
 
-static void destroy_overlays(void) {
-  for (int i = 0; i < overlay_count; ++i) {
-    Overlay *ov = &overlays[i];
-    if (ov->win_picture) {
-      XRenderFreePicture(dpy, ov->win_picture);
-      ov->win_picture = 0;
-    }
-    if (ov->xft_draw) {
-      XftDrawDestroy(ov->xft_draw);
-      ov->xft_draw = NULL;
-    }
-    if (ov->xft_font) {
-      XftFontClose(dpy, ov->xft_font);
-      ov->xft_font = NULL;
+/* the applications/ dirs in precedence order: XDG_DATA_HOME first */
+static void list_desktop_dirs(void) {
+  char buf[512];
+  const char *home = getenv("HOME");
+  const char *data_home = getenv("XDG_DATA_HOME");
+  ddir_count = 0;
+  if (data_home && data_home[0]) {
+    snprintf(buf, sizeof(buf), "%s/applications", data_home);
+    add_desktop_dir(buf, 1);
+  } else if (home && home[0]) {
+    snprintf(buf, sizeof(buf), "%s/.local/share/applications", home);
+    add_desktop_dir(buf, 1);
+  }
+  const char *dirs = getenv("XDG_DATA_DIRS");
+  if (!dirs || !dirs[0])
+    dirs = "/usr/local/share:/usr/share";
+  for (const char *p = dirs; *p;) {
+    int n = (int)strcspn(p, ":");
+    if (n) {
+      snprintf(buf, sizeof(buf), "%.*s/applications", n, p);
+      add_desktop_dir(buf, 1);
     }
-    if (ov->ft_face) {
-      FT_Done_Face(ov->ft_face);
-      ov->ft_face = NULL;
+    p += n;
+    if (*p)
+      p++;
+  }
+}
+
+static void scan_desktop_dir(const char *dir, const char *prefix, int depth) {
+  DIR *d = opendir(dir);
+  if (!d)
+    return;
+  struct dirent *de;
+  while ((de = readdir(d))) {
+    if (de->d_name[0] == '.')
+      continue;
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+    int is_dir = de->d_type == DT_DIR;
+    if (de->d_type == DT_UNKNOWN || de->d_type == DT_LNK) {
+      struct stat st;
+      is_dir = stat(path, &st) == 0 && S_ISDIR(st.st_mode);
     }
-    if (ov->ft_lib) {
-      FT_Done_FreeType(ov->ft_lib);
-      ov->ft_lib = NULL;
+    if (is_dir) {
+      if (depth < DESKTOP_DEPTH_MAX) {
+        char sub[256];
+        snprintf(sub, sizeof(sub), "%s%s-", prefix, de->d_name);
+        add_desktop_dir(path, 0);
+        scan_desktop_dir(path, sub, depth + 1);
+      }
+      continue;
     }
-    if (ov->win) {
-      XDestroyWindow(dpy, ov->win);
-      ov->win = 0;
+    size_t l = strlen(de->d_name);
+    if (l <= 8 || strcmp(de->d_name + l - 8, ".desktop"))
+      continue;
+    if (dfile_count == dfile_cap) {
+      dfile_cap = dfile_cap ? dfile_cap * 2 : 256;
+      dfiles = realloc(dfiles, dfile_cap * sizeof(DesktopFile));
+      if (!dfiles)
+        exit(2);
     }
+    DesktopFile *f = &dfiles[dfile_count];
+    snprintf(f->path, sizeof(f->path), "%s", path);
+    snprintf(f->id, sizeof(f->id), "%s%s", prefix, de->d_name);
+    f->order = dfile_count++;
+    f->shown = 0;
   }
-  free(overlays);
-  overlays = NULL;
-  overlay_count = 0;
-  overlay_visible = 0;
-}
-
-static void hide_overlays(void) {
-  XUngrabKeyboard(dpy, CurrentTime);
-  filter_len = 0;  filter_text[0] = 0;
-  selected_index = 0;
-  scroll_row = 0;
-  destroy_overlays();
-}
-
-static void grab_ctrl_r(void) {
-  KeyCode kc = XKeysymToKeycode(dpy, XK_r);
-  XGrabKey(dpy, kc, ControlMask, root, True,
-             GrabModeAsync, GrabModeAsync);
+  closedir(d);
 }
 
-static void ungrab_ctrl_r(void) {
-  KeyCode kc = XKeysymToKeycode(dpy, XK_r);
-  XUngrabKey(dpy, kc, ControlMask, root);
+static void set_desktop_id(App *a, const char *id) {
+  a->source = path_hash(id);
+  snprintf(a->id, sizeof(a->id), "%s", id);
 }
 
-static void reset_filter(void) {
-  filter_text[0] = 0;
-  filter_len = 0;
+static int dfile_cmp(const void *a, const void *b) {
+  const DesktopFile *x = a, *y = b;
+  int c = strcmp(x->id, y->id);
+  return c ? c : x->order - y->order;
 }
 
-static int strcasestr_simple(const char *hay, const char *needle) {
-  if (!needle[0])
-    return 1;
-  size_t hl = strlen(hay);
-  size_t nl = strlen(needle);
-  for (size_t i = 0; i + nl <= hl; ++i) {
-    size_t j = 0;
-    for (; j < nl; ++j) {
-      char c1 = tolower((unsigned char)hay[i + j]);
-      char c2 = tolower((unsigned char)needle[j]);
-      if (c1 != c2)
-        break;
+/* strip the Exec field codes (%f, %U, ...); %% is a literal % */
+static void strip_field_codes(char *s) {
+  char *o = s;
+  for (char *p = s; *p; ++p) {
+    if (*p != '%') {
+      *o++ = *p;
+    } else if (p[1] == '%') {
+      *o++ = '%';
+      ++p;
+    } else if (p[1]) {
+      ++p;
     }
-    if (j == nl)
-      return 1;
   }
-  return 0;
+  while (o > s && o[-1] == ' ')
+    --o;
+  *o = 0;
 }
 
-static int build_matches(int *out) {
-  int c = 0;
-  for (int i = 0; i < app_count; ++i) {
-    if (!apps[i].valid)
-      continue;
-    if (strcasestr_simple(apps[i].name, filter_text) ||
-        strcasestr_simple(apps[i].cmd, filter_text)) {
-      out[c++] = i;
+/* map an Icon= value to a PNG: absolute paths are taken as they are, names
+   are looked up in the hicolor theme of every data dir, then in pixmaps */
+static void resolve_icon(const char *icon, char *out, size_t outsz) {
+  static const char *const sizes[] = {"48x48",   "64x64",   "32x32",
+                                      "128x128", "256x256", "24x24"};
+  struct stat st;
+  out[0] = 0;
+  if (!icon[0])
+    return;
+  if (icon[0] == '/') {
+    snprintf(out, outsz, "%s", icon);
+    return;
+  }
+  if (strchr(icon, '/'))
+    return;
+  size_t l = strlen(icon);
+  int has_ext = l > 4 && !strcmp(icon + l - 4, ".png");
+  for (int d = 0; d < ddir_count && !has_ext; ++d) {
+    if (!ddirs[d].top)
+      continue;
+    /* the data dir is the applications/ dir minus its last component */
+    int base = (int)(strrchr(ddirs[d].path, '/') - ddirs[d].path);
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+      snprintf(out, outsz, "%.*s/icons/hicolor/%s/apps/%s.png", base,
+               ddirs[d].path, sizes[i], icon);
+      if (stat(out, &st) == 0)
+        return;
     }
   }
-  return c;
+  snprintf(out, outsz, "/usr/share/pixmaps/%s%s", icon,
+           has_ext ? "" : ".png");
+  if (stat(out, &st) != 0)
+    out[0] = 0;
 }
 
-static void launch_app(const char *cmd) {
-  pid_t pid = fork();
-  if (pid == 0) {
-    setsid();
-    execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
-    _exit(127);
+static void parse_desktop_file(DesktopFile *f) {
+  f->shown = 0;
+  FILE *fp = fopen(f->path, "r");
+  if (!fp)
+    return;
+  char line[1024], icon[256] = {0};
+  int in_entry = 0, hidden = 0, is_app = 1;
+  f->name[0] = f->cmd[0] = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    trim_newline(line);
+    if (line[0] == '[') {
+      if (in_entry)
+        break;
+      in_entry = !strcmp(line, "[Desktop Entry]");
+      continue;
+    }
+    char *eq = strchr(line, '=');
+    if (!in_entry || !eq)
+      continue;
+    char *val = eq + 1;
+    while (eq > line && eq[-1] == ' ')
+      --eq;
+    *eq = 0;
+    while (*val == ' ')
+      ++val;
+    if (!strcmp(line, "Name"))
+      snprintf(f->name, sizeof(f->name), "%s", val);
+    else if (!strcmp(line, "Exec"))
+      snprintf(f->cmd, sizeof(f->cmd), "%s", val);
+    else if (!strcmp(line, "Icon"))
+      snprintf(icon, sizeof(icon), "%s", val);
+    else if (!strcmp(line, "NoDisplay") || !strcmp(line, "Hidden"))
+      hidden |= !strcmp(val, "true");
+    else if (!strcmp(line, "Type"))
+      is_app = !strcmp(val, "Application");
   }
-  animate_shrink();
-  hide_overlays();
+  fclose(fp);
+  if (hidden || !is_app || !f->name[0] || !f->cmd[0])
+    return;
+  strip_field_codes(f->cmd);
+  resolve_icon(icon, f->icon, sizeof(f->icon));
+  f->shown = 1;
 }
 
-static void draw_label_truncated_centered(Overlay *ov, const char *text,
-                                          int cell_x, int cell_w,
-                                          int baseline_y) {
-  char buf[256];
-  XGlyphInfo ext;
-  int maxw = cell_w - 12;
-  XftTextExtentsUtf8(dpy, ov->xft_font, (FcChar8 *)text, strlen(text), &ext);
-  if (ext.width <= maxw) {
-    int x = cell_x + (cell_w - ext.width) / 2;
-    XftDrawStringUtf8(ov->xft_draw, &ov->xft_color_text, ov->xft_font, x,
-                      baseline_y, (FcChar8 *)text, strlen(text));
+static void *desktop_worker(void *arg) {
+  (void)arg;
+  int i;
+  while ((i = atomic_fetch_add(&dfile_next, 1)) < dfile_count)
+    parse_desktop_file(&dfiles[i]);
+  return NULL;
+}
+
+/* parse every collected file on a few threads, the caller included */
+static void parse_desktop_files(void) {
+  pthread_t t[WORKER_THREADS_MAX];
+  int started = 0;
+  atomic_store(&dfile_next, 0);
+  for (int i = 1; i < worker_count(); ++i)
+    if (pthread_create(&t[started], NULL, desktop_worker, NULL) == 0)
+      started++;
+  desktop_worker(NULL);
+  for (int i = 0; i < started; ++i)
+    pthread_join(t[i], NULL);
+}
+
+static uint32_t strtab_add(char **tab, size_t *len, size_t *cap,
+                           const char *s) {
+  size_t n = strlen(s) + 1;
+  if (*len + n > *cap) {
+    *cap = (*len + n) * 2;
+    *tab = realloc(*tab, *cap);
+    if (!*tab)
+      exit(2);
+  }
+  memcpy(*tab + *len, s, n);
+  *len += n;
+  return (uint32_t)(*len - n);
+}
+
+/* write the desktop apps as they are in memory, with the dir mtimes that
+   were current when they were read */
+static void save_desktop_index(void) {
+  char path[512], tmp[520];
+  if (!cache_path(path, sizeof(path), "desktop.idx"))
+    return;
+  uint32_t shown = 0;
+  for (int i = 0; i < app_count; ++i)
+    shown += apps[i].source != 0;
+
+  char *strs = NULL;
+  size_t slen = 0, scap = 0;
+  DesktopIndexDir *dirs = calloc(ddir_count + 1, sizeof(DesktopIndexDir));
+  DesktopIndexEntry *ents = calloc(shown + 1, sizeof(DesktopIndexEntry));
+  if (!dirs || !ents)
+    exit(2);
+  for (int i = 0; i < ddir_count; ++i) {
+    dirs[i].mtime_sec = ddirs[i].mtime_sec;
+    dirs[i].mtime_nsec = ddirs[i].mtime_nsec;
+    dirs[i].path = strtab_add(&strs, &slen, &scap, ddirs[i].path);
+    dirs[i].top = ddirs[i].top;
+  }
+  for (int i = 0, n = 0; i < app_count; ++i) {
+    App *a = &apps[i];
+    if (!a->source)
+      continue;
+    ents[n].name = strtab_add(&strs, &slen, &scap, a->name);
+    ents[n].icon = strtab_add(&strs, &slen, &scap, a->icon_path);
+    ents[n].cmd = strtab_add(&strs, &slen, &scap, a->cmd);
+    ents[n].id = strtab_add(&strs, &slen, &scap, a->id);
+    n++;
+  }
+
+  DesktopIndexHeader hdr = {DESKTOP_INDEX_MAGIC, ddir_count, shown, slen};
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  FILE *fp = fopen(tmp, "wb");
+  if (fp) {
+    int ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+             fwrite(dirs, sizeof(*dirs), ddir_count, fp) ==
+                 (size_t)ddir_count &&
+             fwrite(ents, sizeof(*ents), shown, fp) == shown &&
+             fwrite(strs, 1, slen, fp) == slen;
+    /* replace the old index atomically */
+    if (fclose(fp) == 0 && ok)
+      rename(tmp, path);
+    else
+      unlink(tmp);
+  }
+  free(strs);
+  free(dirs);
+  free(ents);
+}
+
+/* read the index with a single read() and use it if every directory it was
+   built from is unchanged; ddirs holds the current top-level dirs */
+static int load_desktop_index(void) {
+  char path[512];
+  if (!cache_path(path, sizeof(path), "desktop.idx"))
+    return 0;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 0;
+  struct stat st;
+  char *buf = NULL;
+  int ok = fstat(fd, &st) == 0 &&
+           st.st_size >= (off_t)sizeof(DesktopIndexHeader) &&
+           (buf = malloc(st.st_size)) &&
+           read(fd, buf, st.st_size) == st.st_size;
+  close(fd);
+  if (!ok) {
+    free(buf);
+    return 0;
+  }
+
+  DesktopIndexHeader *hdr = (DesktopIndexHeader *)buf;
+  DesktopIndexDir *dirs = (DesktopIndexDir *)(hdr + 1);
+  DesktopIndexEntry *ents = (DesktopIndexEntry *)(dirs + hdr->ndirs);
+  const char *strs = (const char *)(ents + hdr->nentries);
+  uint32_t slen = hdr->strings_len;
+  ok = hdr->magic == DESKTOP_INDEX_MAGIC && hdr->ndirs < (1u << 20) &&
+       hdr->nentries < (1u << 24) &&
+       (size_t)st.st_size == sizeof(*hdr) + hdr->ndirs * sizeof(*dirs) +
+                                 hdr->nentries * sizeof(*ents) + slen &&
+       slen && strs[slen - 1] == 0;
+
+  /* the same top-level dirs in the same order, and no dir changed */
+  int tops = ddir_count, t = 0;
+  for (uint32_t i = 0; ok && i < hdr->ndirs; ++i) {
+    if (dirs[i].path >= slen) {
+      ok = 0;
+      break;
+    }
+    const char *p = strs + dirs[i].path;
+    int64_t sec, nsec;
+    if (dirs[i].top) {
+      if (t >= tops || strcmp(p, ddirs[t].path)) {
+        ok = 0;
+        break;
+      }
+      sec = ddirs[t].mtime_sec;
+      nsec = ddirs[t].mtime_nsec;
+      t++;
+    } else {
+      stat_mtime(p, &sec, &nsec);
+    }
+    ok = sec == dirs[i].mtime_sec && nsec == dirs[i].mtime_nsec;
+  }
+  ok = ok && t == tops;
+  for (uint32_t i = 0; ok && i < hdr->nentries; ++i)
+    ok = ents[i].name < slen && ents[i].icon < slen && ents[i].cmd < slen &&
+         ents[i].id < slen;
+
+  if (ok) {
+    for (uint32_t i = 0; i < hdr->ndirs; ++i)
+      if (!dirs[i].top)
+        add_desktop_dir(strs + dirs[i].path, 0);
+    for (uint32_t i = 0; i < hdr->nentries; ++i)
+      set_desktop_id(add_app(strs + ents[i].name, strs + ents[i].icon,
+                             strs + ents[i].cmd),
+                     strs + ents[i].id);
+  }
+  free(buf);
+  return ok;
+}
+
+/* scan the top-level dirs listed in ddirs and add an app for every file
+   that is shown */
+static void scan_desktop_entries(void) {
+  int tops = ddir_count;
+  dfile_count = 0;
+  for (int i = 0; i < tops; ++i) {
+    char dir[512];
+    /* scanning appends the subdirectories to ddirs, which may move it */
+    snprintf(dir, sizeof(dir), "%s", ddirs[i].path);
+    scan_desktop_dir(dir, "", 0);
+  }
+  /* keep the first file of every id, in search path order */
+  qsort(dfiles, dfile_count, sizeof(DesktopFile), dfile_cmp);
+  int n = 0;
+  for (int i = 0; i < dfile_count; ++i)
+    if (!n || strcmp(dfiles[i].id, dfiles[n - 1].id))
+      dfiles[n++] = dfiles[i];
+  dfile_count = n;
+
+  parse_desktop_files();
+  for (int i = 0; i < dfile_count; ++i)
+    if (dfiles[i].shown)
+      set_desktop_id(add_app(dfiles[i].name, dfiles[i].icon, dfiles[i].cmd),
+                     dfiles[i].id);
+  free(dfiles);
+  dfiles = NULL;
+  dfile_count = dfile_cap = 0;
+}
+
+static void load_desktop_entries(void) {
+  list_desktop_dirs();
+  if (load_desktop_index())
+    return;
+  scan_desktop_entries();
+  save_desktop_index();
+}
+
+/* ---------- hot reload ---------- */
+
+/* ENTRIES_FILE (through its directory, so that replacing the file is seen
+   too) and every scanned applications/ dir are watched with inotify. A
+   change re-parses only the file that changed; apps that stay the same keep
+   their place and their atlas cell. If the kernel drops events the desktop
+   dirs are scanned again */
+static int inotify_fd = -1;
+static int entries_wd = -1;
+static int *dir_wds = NULL; /* watch descriptor of ddirs[i], -1 = none */
+static int dir_wd_cap = 0;
+
+static void watch_dir(int d) {
+  if (d >= dir_wd_cap) {
+    int cap = dir_wd_cap ? dir_wd_cap * 2 : 16;
+    while (cap <= d)
+      cap *= 2;
+    dir_wds = realloc(dir_wds, cap * sizeof(int));
+    if (!dir_wds)
+      exit(2);
+    for (int i = dir_wd_cap; i < cap; ++i)
+      dir_wds[i] = -1;
+    dir_wd_cap = cap;
+  }
+  dir_wds[d] = inotify_add_watch(inotify_fd, ddirs[d].path,
+                                 IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                     IN_MOVED_FROM | IN_MOVED_TO);
+}
+
+static void watch_sources(void) {
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd < 0)
     return;
+  char dir[512];
+  snprintf(dir, sizeof(dir), "%s", ENTRIES_FILE);
+  *strrchr(dir, '/') = 0;
+  entries_wd = inotify_add_watch(inotify_fd, dir,
+                                 IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                     IN_MOVED_FROM | IN_MOVED_TO);
+  for (int d = 0; d < ddir_count; ++d)
+    watch_dir(d);
+}
+
+/* startup order: ENTRIES_FILE by line, then the desktop files by id */
+static int app_order_cmp(const void *a, const void *b) {
+  const App *x = &apps[*(const int *)a], *y = &apps[*(const int *)b];
+  if (!x->source != !y->source)
+    return x->source ? 1 : -1;
+  if (!x->source)
+    return x->line - y->line;
+  return strcmp(x->id, y->id);
+}
+
+/* drop the apps marked invalid and put the rest, including the ones a
+   reload appended, in the order a fresh start would load them; the
+   selection follows its app */
+static void compact_apps(void) {
+  int n = 0, sel = -1;
+  for (int i = 0; i < app_count; ++i) {
+    if (!apps[i].valid) {
+      atlas_release(apps[i].icon_slot);
+      continue;
+    }
+    if (i == selected_index)
+      sel = n;
+    if (n != i)
+      apps[n] = apps[i];
+    n++;
+  }
+  app_count = n;
+  selected_index = sel;
+
+  int *order = malloc((app_count + 1) * sizeof(int));
+  App *sorted = malloc((app_cap + 1) * sizeof(App));
+  if (!order || !sorted)
+    exit(2);
+  for (int i = 0; i < app_count; ++i)
+    order[i] = i;
+  qsort(order, app_count, sizeof(int), app_order_cmp);
+  for (int i = 0; i < app_count; ++i) {
+    sorted[i] = apps[order[i]];
+    if (order[i] == sel)
+      selected_index = i;
+  }
+  free(order);
+  free(apps);
+  apps = sorted;
+}
+
+/* diff the entries file against the apps it produced last time */
+static void reload_entries_file(void) {
+  for (int i = 0; i < app_count; ++i)
+    apps[i].seen = apps[i].source != 0;
+  FILE *f = fopen(ENTRIES_FILE, "r");
+  char line[1024];
+  int n = 0;
+  while (f && fgets(line, sizeof(line), f)) {
+    if (line[0] == '#' || line[0] == 0)
+      continue;
+    char name[MAX_LABEL], icon[512], cmd[512];
+    parse_dsv_line(line, name, icon, cmd);
+    if (!name[0] || !cmd[0])
+      continue;
+    int i = 0;
+    for (; i < app_count; ++i)
+      if (!apps[i].seen && !strcmp(apps[i].name, name) &&
+          !strcmp(apps[i].icon_path, icon) && !strcmp(apps[i].cmd, cmd))
+        break;
+    if (i == app_count)
+      add_app(name, icon, cmd);
+    apps[i].seen = 1;
+    apps[i].line = n++;
+  }
+  if (f)
+    fclose(f);
+  for (int i = 0; i < app_count; ++i)
+    if (!apps[i].seen)
+      apps[i].valid = 0;
+  compact_apps();
+}
+
+/* id prefix of the files in ddirs[d]: its path below its applications/
+   dir with '/' turned into '-', empty for an applications/ dir itself */
+static void desktop_dir_prefix(int d, char *out, size_t outsz) {
+  size_t best = 0;
+  out[0] = 0;
+  for (int t = 0; t < ddir_count; ++t) {
+    size_t l = strlen(ddirs[t].path);
+    if (ddirs[t].top && l > best && !strncmp(ddirs[d].path, ddirs[t].path, l) &&
+        ddirs[d].path[l] == '/')
+      best = l;
+  }
+  if (best)
+    snprintf(out, outsz, "%s-", ddirs[d].path + best + 1);
+  for (char *p = out; *p; ++p)
+    if (*p == '/')
+      *p = '-';
+}
+
+/* re-read the desktop file with this id from the first dir that has it,
+   in search path order; the caller compacts the app list */
+static void reload_desktop_id(const char *id) {
+  static DesktopFile f;
+  char prefix[512];
+  snprintf(f.id, sizeof(f.id), "%s", id);
+  uint64_t source = path_hash(f.id);
+  for (int i = 0; i < app_count; ++i)
+    if (apps[i].source == source)
+      apps[i].valid = 0;
+
+  for (int t = 0; t < ddir_count; ++t) {
+    if (!ddirs[t].top)
+      continue;
+    size_t tl = strlen(ddirs[t].path);
+    for (int d = 0; d < ddir_count; ++d) {
+      struct stat st;
+      if (d != t &&
+          (ddirs[d].top || strncmp(ddirs[d].path, ddirs[t].path, tl) ||
+           ddirs[d].path[tl] != '/'))
+        continue;
+      desktop_dir_prefix(d, prefix, sizeof(prefix));
+      size_t pl = strlen(prefix);
+      if (strncmp(f.id, prefix, pl) ||
+          snprintf(f.path, sizeof(f.path), "%s/%s", ddirs[d].path,
+                   f.id + pl) >= (int)sizeof(f.path) ||
+          stat(f.path, &st) != 0 || !S_ISREG(st.st_mode))
+        continue;
+      parse_desktop_file(&f);
+      if (f.shown)
+        set_desktop_id(add_app(f.name, f.icon, f.cmd), f.id);
+      return;
+    }
+  }
+}
+
+static void desktop_dir_added(int parent, const char *name) {
+  char path[512], prefix[512], id[1024];
+  if (snprintf(path, sizeof(path), "%s/%s", ddirs[parent].path, name) >=
+      (int)sizeof(path))
+    return;
+  add_desktop_dir(path, 0);
+  watch_dir(ddir_count - 1);
+  desktop_dir_prefix(ddir_count - 1, prefix, sizeof(prefix));
+  DIR *dir = opendir(path);
+  struct dirent *de;
+  while (dir && (de = readdir(dir))) {
+    size_t l = strlen(de->d_name);
+    if (l <= 8 || strcmp(de->d_name + l - 8, ".desktop"))
+      continue;
+    snprintf(id, sizeof(id), "%s%s", prefix, de->d_name);
+    reload_desktop_id(id);
+  }
+  if (dir)
+    closedir(dir);
+}
+
+/* forget a subdirectory that was deleted or moved away, and everything
+   below it; the ids it provided are looked up again since a dir later in
+   the search path may have them too */
+static void desktop_dir_removed(int parent, const char *name) {
+  char path[512], prefix[512], id[1024];
+  if (snprintf(path, sizeof(path), "%s/%s", ddirs[parent].path, name) >=
+      (int)sizeof(path))
+    return;
+  desktop_dir_prefix(parent, prefix, sizeof(prefix));
+  snprintf(id, sizeof(id), "%s%s-", prefix, name);
+
+  size_t l = strlen(path);
+  int n = 0;
+  for (int d = 0; d < ddir_count; ++d) {
+    if (!ddirs[d].top && !strncmp(ddirs[d].path, path, l) &&
+        (ddirs[d].path[l] == 0 || ddirs[d].path[l] == '/')) {
+      /* a deleted dir already lost its watch */
+      if (d < dir_wd_cap && dir_wds[d] >= 0)
+        inotify_rm_watch(inotify_fd, dir_wds[d]);
+      continue;
+    }
+    ddirs[n] = ddirs[d];
+    if (d < dir_wd_cap)
+      dir_wds[n] = dir_wds[d];
+    n++;
+  }
+  for (int d = n; d < ddir_count && d < dir_wd_cap; ++d)
+    dir_wds[d] = -1;
+  ddir_count = n;
+
+  /* reloading appends to apps, so take the ids out first */
+  size_t pl = strlen(id);
+  int count = 0;
+  for (int i = 0; i < app_count; ++i)
+    count += apps[i].source && apps[i].valid && !strncmp(apps[i].id, id, pl);
+  char (*ids)[256] = malloc((count + 1) * sizeof(*ids));
+  if (!ids)
+    exit(2);
+  count = 0;
+  for (int i = 0; i < app_count; ++i)
+    if (apps[i].source && apps[i].valid && !strncmp(apps[i].id, id, pl))
+      memcpy(ids[count++], apps[i].id, sizeof(*ids));
+  for (int i = 0; i < count; ++i)
+    reload_desktop_id(ids[i]);
+  free(ids);
+}
+
+/* events were dropped because the queue overflowed: read every desktop dir
+   again. Watches on dirs that are still there keep their descriptor */
+static void rescan_desktop_entries(void) {
+  for (int d = 0; d < dir_wd_cap; ++d)
+    dir_wds[d] = -1;
+  for (int i = 0; i < app_count; ++i)
+    if (apps[i].source)
+      apps[i].valid = 0;
+  list_desktop_dirs();
+  scan_desktop_entries();
+  for (int d = 0; d < ddir_count; ++d)
+    watch_dir(d);
+}
+
+/* apply every queued change; returns 1 when the app list changed */
+static int handle_inotify(void) {
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  const char *entries_name = strrchr(ENTRIES_FILE, '/') + 1;
+  int entries = 0, desktop = 0, overflow = 0;
+  ssize_t n;
+  while ((n = read(inotify_fd, buf, sizeof(buf))) > 0) {
+    struct inotify_event *ev;
+    for (char *p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+      ev = (struct inotify_event *)p;
+      overflow |= (ev->mask & IN_Q_OVERFLOW) != 0;
+      if (!ev->len)
+        continue;
+      if (ev->wd == entries_wd) {
+        entries |= !strcmp(ev->name, entries_name);
+        continue;
+      }
+      int d = 0;
+      while (d < ddir_count && (d >= dir_wd_cap || dir_wds[d] != ev->wd))
+        ++d;
+      if (d == ddir_count)
+        continue;
+      if (ev->mask & IN_ISDIR) {
+        if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+          desktop_dir_added(d, ev->name);
+          desktop = 1;
+        } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+          desktop_dir_removed(d, ev->name);
+          desktop = 1;
+        }
+        continue;
+      }
+      size_t l = strlen(ev->name);
+      if (l <= 8 || strcmp(ev->name + l - 8, ".desktop"))
+        continue;
+      char prefix[512], id[1024];
+      desktop_dir_prefix(d, prefix, sizeof(prefix));
+      snprintf(id, sizeof(id), "%s%s", prefix, ev->name);
+      reload_desktop_id(id);
+      desktop = 1;
+    }
+  }
+  if (overflow) {
+    rescan_desktop_entries();
+    entries = desktop = 1;
+  }
+  if (desktop) {
+    compact_apps();
+    /* an edit in place leaves the dir mtimes alone, so the index is
+       written again from what is loaded now rather than left stale */
+    for (int d = 0; d < ddir_count; ++d)
+      stat_mtime(ddirs[d].path, &ddirs[d].mtime_sec, &ddirs[d].mtime_nsec);
+    save_desktop_index();
+  }
+  if (entries)
+    reload_entries_file();
+  return entries || desktop;
+}
+
+/* ---------- background decoding ---------- */
+
+/* icons missing from the cache are decoded and scaled by a few worker
+   threads. Finished jobs are pushed onto a lock-free stack and announced
+   through an eventfd that the main loop polls next to the X connection, so
+   the main thread only stores them in the cache and the atlas. Jobs are
+   keyed by the icon's path hash: apps come and go while a job is in flight,
+   and one file shown by several apps is decoded once */
+typedef struct DecodeJob {
+  struct DecodeJob *next;
+  uint64_t hash;
+  struct stat st;
+  int ok;
+  char path[512];
+  uint32_t argb[ICON_SIZE * ICON_SIZE];
+} DecodeJob;
+
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobs_cond = PTHREAD_COND_INITIALIZER;
+static DecodeJob *jobs_head = NULL, *jobs_tail = NULL;
+static _Atomic(DecodeJob *) done_head = NULL;
+static int decode_efd = -1;
+static uint64_t *pending = NULL; /* hashes of the jobs in flight */
+static int pending_count = 0, pending_cap = 0;
+
+static void *decode_worker(void *arg) {
+  (void)arg;
+  for (;;) {
+    pthread_mutex_lock(&jobs_lock);
+    while (!jobs_head)
+      pthread_cond_wait(&jobs_cond, &jobs_lock);
+    DecodeJob *j = jobs_head;
+    jobs_head = j->next;
+    if (!jobs_head)
+      jobs_tail = NULL;
+    pthread_mutex_unlock(&jobs_lock);
+
+    unsigned w, h;
+    uint32_t *argb = decode_png_file(j->path, &w, &h);
+    if (argb) {
+      scale_to_icon(argb, w, h, j->argb);
+      free(argb);
+    }
+    j->ok = argb != NULL;
+
+    j->next = atomic_load_explicit(&done_head, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&done_head, &j->next, j,
+                                                  memory_order_release,
+                                                  memory_order_relaxed))
+      ;
+    uint64_t one = 1;
+    while (write(decode_efd, &one, sizeof(one)) < 0 && errno == EINTR)
+      ;
+  }
+  return NULL;
+}
+
+static int decode_start(void) {
+  if (decode_efd >= 0)
+    return 1;
+  decode_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (decode_efd < 0)
+    return 0;
+  int started = 0;
+  for (int i = 0, n = worker_count(); i < n; ++i) {
+    pthread_t t;
+    if (pthread_create(&t, NULL, decode_worker, NULL) == 0) {
+      pthread_detach(t);
+      started++;
+    }
+  }
+  if (!started) {
+    close(decode_efd);
+    decode_efd = -1;
+  }
+  return started > 0;
+}
+
+static int decode_submit(uint64_t hash, const struct stat *st,
+                         const char *path) {
+  if (!decode_start())
+    return 0;
+  for (int i = 0; i < pending_count; ++i)
+    if (pending[i] == hash)
+      return 1;
+  if (pending_count == pending_cap) {
+    pending_cap = pending_cap ? pending_cap * 2 : 64;
+    pending = realloc(pending, pending_cap * sizeof(uint64_t));
+    if (!pending)
+      exit(2);
   }
-  const char *ellipsis = "...";
-  int ell_len = 3;
-  int len = strlen(text);
-  for (int n = len; n > 0; --n) {
-    if (n + ell_len >= (int)sizeof(buf))
+  pending[pending_count++] = hash;
+  DecodeJob *j = calloc(1, sizeof(*j));
+  if (!j)
+    exit(2);
+  j->hash = hash;
+  j->st = *st;
+  snprintf(j->path, sizeof(j->path), "%s", path);
+  pthread_mutex_lock(&jobs_lock);
+  if (jobs_tail)
+    jobs_tail->next = j;
+  else
+    jobs_head = j;
+  jobs_tail = j;
+  pthread_cond_signal(&jobs_cond);
+  pthread_mutex_unlock(&jobs_lock);
+  return 1;
+}
+
+/* give an icon to every app showing that file that has none yet; they
+   share one atlas cell. Returns 1 when any app got it */
+static int assign_icon(uint64_t hash, const uint32_t *argb) {
+  int slot = -1;
+  for (int i = 0; i < app_count; ++i) {
+    App *a = &apps[i];
+    if (!a->valid || a->icon_slot >= 0 || a->icon_hash != hash)
       continue;
-    memcpy(buf, text, n);
-    memcpy(buf + n, ellipsis, ell_len);
-    buf[n + ell_len] = 0;
-    XftTextExtentsUtf8(dpy, ov->xft_font, (FcChar8 *)buf, n + ell_len, &ext);
-    if (ext.width <= maxw) {
-      int x = cell_x + (cell_w - ext.width) / 2;
-      XftDrawStringUtf8(ov->xft_draw, &ov->xft_color_text, ov->xft_font, x,
-                        baseline_y, (FcChar8 *)buf, n + ell_len);
+    if (slot < 0) {
+      slot = atlas_insert(argb);
+      if (slot < 0)
+        return 0;
+    } else {
+      atlas_ref(slot);
+    }
+    a->icon_slot = slot;
+    a->icon_tried = 1;
+  }
+  return slot >= 0;
+}
+
+/* store every finished decode; returns 1 when an app got its icon */
+static int collect_decoded(void) {
+  uint64_t n;
+  if (decode_efd < 0 || read(decode_efd, &n, sizeof(n)) < 0)
+    return 0;
+  DecodeJob *list = atomic_exchange_explicit(&done_head, NULL,
+                                             memory_order_acquire);
+  /* the stack is newest first; reverse it to store in completion order */
+  DecodeJob *fifo = NULL;
+  while (list) {
+    DecodeJob *next = list->next;
+    list->next = fifo;
+    fifo = list;
+    list = next;
+  }
+  int changed = 0;
+  while (fifo) {
+    DecodeJob *j = fifo;
+    fifo = j->next;
+    icache_put(j->hash, &j->st, j->ok ? j->argb : NULL);
+    for (int i = 0; i < pending_count; ++i)
+      if (pending[i] == j->hash) {
+        pending[i] = pending[--pending_count];
+        break;
+      }
+    if (j->ok)
+      changed |= assign_icon(j->hash, j->argb);
+    free(j);
+  }
+  return changed;
+}
+
+/* show the icon the first time its cell is shown: straight from the cache,
+   or once a worker has decoded it. Until then (and when there is none) the
+   cell shows a placeholder */
+static void ensure_app_icon(App *a) {
+  if (a->icon_tried)
+    return;
+  a->icon_tried = 1;
+  uint64_t hash = a->icon_hash;
+  if (!hash || !have_argb_pixmaps())
+    return;
+  /* an app added later may show a file that is already in the atlas */
+  for (int i = 0; i < app_count; ++i)
+    if (apps[i].valid && apps[i].icon_slot >= 0 && apps[i].icon_hash == hash) {
+      a->icon_slot = apps[i].icon_slot;
+      atlas_ref(a->icon_slot);
       return;
     }
+  struct stat st;
+  if (stat(a->icon_path, &st) < 0)
+    return;
+
+  IconRecord *r = icache_find(hash);
+  if (icache_fresh(r, &st)) {
+    if (r->ok)
+      assign_icon(hash, r->argb);
+  } else if (!decode_submit(hash, &st, a->icon_path)) {
+    /* no threads: decode right here */
+    uint32_t scaled[ICON_SIZE * ICON_SIZE];
+    unsigned w, h;
+    uint32_t *argb = decode_png_file(a->icon_path, &w, &h);
+    if (argb) {
+      scale_to_icon(argb, w, h, scaled);
+      free(argb);
+      assign_icon(hash, scaled);
+    }
+    icache_put(hash, &st, argb ? scaled : NULL);
+  }
+}
+
+static void set_font(Overlay *ov) {
+  if (!FcInit())
+    exit(2);
+  ov->xft_font =
+      xft_font_from_memory(dpy, screen, verdana_ttf, (size_t)verdana_ttf_len,
+                           10.0, &ov->ft_lib, &ov->ft_face);
+  if (!ov->xft_font)
+    exit(2);
+  XWindowAttributes wa;
+  XGetWindowAttributes(dpy, ov->win, &wa);
+  ov->xft_draw = XftDrawCreate(dpy, ov->frame, wa.visual, wa.colormap);
+  if (!ov->xft_draw)
+    exit(2);
+  if (!XftColorAllocName(dpy, wa.visual, wa.colormap, "white",
+                         &ov->xft_color_text))
+    exit(2);
+  if (!XftColorAllocName(dpy, wa.visual, wa.colormap, "gray80",
+                         &ov->xft_color_dim))
+    exit(2);
+  XRenderPictFormat *dst_fmt = XRenderFindVisualFormat(dpy, visual);
+  if (dst_fmt)
+    ov->frame_picture = XRenderCreatePicture(dpy, ov->frame, dst_fmt, 0, NULL);
+  ov->bg_pixmap = shared_bg_pixmap;
+  ov->bg_picture = shared_bg_picture;
+  ov->bg_w = shared_bg_w;
+  ov->bg_h = shared_bg_h;
+}
+
+/* the monitors the overlays were built for */
+static XRectangle *layout_screens = NULL;
+static int layout_count = 0;
+
+/* the Xinerama screens, or the whole root without Xinerama; the caller
+   frees the result */
+static XRectangle *query_screens(int *count) {
+  int event_base, error_base;
+  int screens = 0;
+  XineramaScreenInfo *info = NULL;
+  if (XineramaQueryExtension(dpy, &event_base, &error_base) &&
+      XineramaIsActive(dpy)) {
+    info = XineramaQueryScreens(dpy, &screens);
   }
+  if (!info || screens < 1)
+    screens = 1;
+  XRectangle *r = calloc(screens, sizeof(XRectangle));
+  if (!r)
+    exit(2);
+  if (!info) {
+    r[0].width = DisplayWidth(dpy, screen);
+    r[0].height = DisplayHeight(dpy, screen);
+  }
+  for (int i = 0; info && i < screens; ++i) {
+    r[i].x = info[i].x_org;
+    r[i].y = info[i].y_org;
+    r[i].width = info[i].width;
+    r[i].height = info[i].height;
+  }
+  if (info)
+    XFree(info);
+  *count = screens;
+  return r;
+}
+
+/* rearranging monitors need not resize the root, so no ConfigureNotify
+   comes; the layout is compared again before every show */
+static int layout_changed(void) {
+  int n;
+  XRectangle *now = query_screens(&n);
+  int changed = n != layout_count ||
+                memcmp(now, layout_screens, n * sizeof(XRectangle)) != 0;
+  free(now);
+  return changed;
+}
+
+static void create_overlays(void) {
+  free(layout_screens);
+  layout_screens = query_screens(&layout_count);
+  int screens = layout_count;
+  XRectangle *r = layout_screens;
+
+  int min_w = r[0].width;
+  int min_h = r[0].height;
+  for (int i = 1; i < screens; ++i) {
+    if (r[i].width < min_w)
+      min_w = r[i].width;
+    if (r[i].height < min_h)
+      min_h = r[i].height;
+  }
+
+  overlay_count = screens;
+  overlays = calloc(screens, sizeof(Overlay));
+  for (int i = 0; i < screens; ++i) {
+    int sw = r[i].width;
+    int sh = r[i].height;
+    int sx = r[i].x;
+    int sy = r[i].y;
+    int w = (int)(min_w * 0.5);  /* was 0.3 */
+    int h = (int)(min_h * 0.5);  /* was 0.3 */
+    int x = sx + (sw - w) / 2;
+    int y = sy + (sh - h) / 2;
+
+    XSetWindowAttributes attr = {0};
+    attr.override_redirect = True;
+    attr.colormap = colormap;
+    attr.border_pixel = 0;
+    attr.background_pixel = 0;
+    attr.event_mask = ExposureMask | KeyPressMask | StructureNotifyMask;
+    Window win =
+        XCreateWindow(dpy, root, x, y, w, h, 0, depth, InputOutput, visual,
+                      CWOverrideRedirect | CWColormap | CWBorderPixel |
+                          CWBackPixel | CWEventMask,
+                      &attr);
+    XSetWindowBackgroundPixmap(dpy, win, None);
+
+    overlays[i].win = win;
+    overlays[i].x = x;
+    overlays[i].y = y;
+    overlays[i].w = w;
+    overlays[i].h = h;
+    overlays[i].frame = XCreatePixmap(dpy, win, w, h, depth);
+    overlays[i].gc = XCreateGC(dpy, overlays[i].frame, 0, NULL);
+
+    set_font(&overlays[i]);
+  }
+}
+
+static void destroy_overlays(void) {
+  for (int i = 0; i < overlay_count; ++i) {
+    Overlay *ov = &overlays[i];
+    if (ov->frame_picture)
+      XRenderFreePicture(dpy, ov->frame_picture);
+    if (ov->xft_draw) {
+      XftColorFree(dpy, visual, colormap, &ov->xft_color_text);
+      XftColorFree(dpy, visual, colormap, &ov->xft_color_dim);
+      XftDrawDestroy(ov->xft_draw);
+    }
+    if (ov->xft_font)
+      XftFontClose(dpy, ov->xft_font);
+    if (ov->ft_face)
+      FT_Done_Face(ov->ft_face);
+    if (ov->ft_lib)
+      FT_Done_FreeType(ov->ft_lib);
+    if (ov->gc)
+      XFreeGC(dpy, ov->gc);
+    if (ov->frame)
+      XFreePixmap(dpy, ov->frame);
+    if (ov->win)
+      XDestroyWindow(dpy, ov->win);
+  }
+  free(overlays);
+  overlays = NULL;
+  overlay_count = 0;
+  first_frame_valid = 0;
+}
+
+/* the overlays, their fonts and frames are created at startup and only
+   mapped and unmapped afterwards, until the monitor layout changes */
+static void update_layout(void) {
+  if (!layout_dirty)
+    return;
+  destroy_overlays();
+  create_overlays();
+  layout_dirty = 0;
+}
+
+static void show_overlays(void) {
+  if (layout_changed())
+    layout_dirty = 1;
+  update_layout();
+  for (int i = 0; i < overlay_count; ++i)
+    XMapRaised(dpy, overlays[i].win);
+  XGrabKeyboard(dpy, root, True, GrabModeAsync, GrabModeAsync, CurrentTime);
+  overlay_visible = 1;
+  selected_index = -1; /* the best ranked match */
+  scroll_row = 0;
+}
+
+static void hide_overlays(void) {
+  XUngrabKeyboard(dpy, CurrentTime);
+  filter_len = 0;  filter_text[0] = 0;
+  selected_index = -1;
+  scroll_row = 0;
+  /* undo animate_shrink while unmapped */
+  for (int i = 0; i < overlay_count; ++i) {
+    Overlay *ov = &overlays[i];
+    XUnmapWindow(dpy, ov->win);
+    XMoveResizeWindow(dpy, ov->win, ov->x, ov->y, ov->w, ov->h);
+  }
+  overlay_visible = 0;
+}
+
+static void grab_ctrl_r(void) {
+  KeyCode kc = XKeysymToKeycode(dpy, XK_r);
+  XGrabKey(dpy, kc, ControlMask, root, True,
+             GrabModeAsync, GrabModeAsync);
+}
+
+static void ungrab_ctrl_r(void) {
+  KeyCode kc = XKeysymToKeycode(dpy, XK_r);
+  XUngrabKey(dpy, kc, ControlMask, root);
+}
+
+static void reset_filter(void) {
+  filter_text[0] = 0;
+  filter_len = 0;
+}
+
+/* ---------- launch history ---------- */
+
+/* every launch appends one fixed-size record to a log under
+   $XDG_STATE_HOME/x11kickstart. At startup the log is read with a single
+   read(), merged per app and written back compacted. The merged table is
+   only consulted when the search index is rebuilt, which orders the apps
+   by frecency once, so ranking costs nothing per keystroke */
+typedef struct {
+  uint64_t key;   /* hash of name and command */
+  uint32_t count; /* launches */
+  uint32_t last;  /* time of the latest one */
+} LaunchRecord;
+
+static LaunchRecord *history = NULL; /* sorted by key, one per app */
+static size_t history_count = 0, history_cap = 0;
+static int history_fd = -1;
+
+static uint64_t app_key(const App *a) {
+  uint64_t h = path_hash(a->name);
+  h = (h ^ 0x1f) * 1099511628211ull;
+  for (const char *s = a->cmd; *s; ++s)
+    h = (h ^ (unsigned char)*s) * 1099511628211ull;
+  return h;
+}
+
+static int record_cmp(const void *a, const void *b) {
+  uint64_t x = ((const LaunchRecord *)a)->key;
+  uint64_t y = ((const LaunchRecord *)b)->key;
+  return x < y ? -1 : x > y;
+}
+
+static LaunchRecord *history_find(uint64_t key) {
+  size_t lo = 0, hi = history_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (history[mid].key < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < history_count && history[lo].key == key ? &history[lo] : NULL;
+}
+
+static void history_open(void) {
+  char path[512], tmp[520];
+  if (!state_path(path, sizeof(path), "launches"))
+    return;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= 0) {
+    history_cap = st.st_size / sizeof(LaunchRecord) + 16;
+    history = malloc(history_cap * sizeof(LaunchRecord));
+    if (!history)
+      exit(2);
+    ssize_t n = read(fd, history, st.st_size);
+    history_count = n > 0 ? n / sizeof(LaunchRecord) : 0;
+  }
+  if (fd >= 0)
+    close(fd);
+
+  /* merge the records of each app */
+  size_t logged = history_count, m = 0;
+  if (history_count)
+    qsort(history, history_count, sizeof(LaunchRecord), record_cmp);
+  for (size_t i = 0; i < history_count; ++i) {
+    if (m && history[m - 1].key == history[i].key) {
+      history[m - 1].count += history[i].count;
+      if (history[i].last > history[m - 1].last)
+        history[m - 1].last = history[i].last;
+    } else {
+      history[m++] = history[i];
+    }
+  }
+  history_count = m;
+
+  if (m != logged) {
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd >= 0) {
+      ssize_t len = m * sizeof(LaunchRecord);
+      int ok = write(fd, history, len) == len;
+      if (close(fd) == 0 && ok)
+        rename(tmp, path);
+      else
+        unlink(tmp);
+    }
+  }
+  history_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+}
+
+static void history_record(const App *a) {
+  LaunchRecord rec = {app_key(a), 1, (uint32_t)time(NULL)};
+  /* O_APPEND keeps the records of concurrent launchers whole */
+  if (history_fd >= 0)
+    (void)!write(history_fd, &rec, sizeof(rec));
+  LaunchRecord *r = history_find(rec.key);
+  if (r) {
+    r->count++;
+    r->last = rec.last;
+    return;
+  }
+  if (history_count == history_cap) {
+    history_cap = history_cap ? history_cap * 2 : 64;
+    history = realloc(history, history_cap * sizeof(LaunchRecord));
+    if (!history)
+      exit(2);
+  }
+  size_t pos = 0;
+  while (pos < history_count && history[pos].key < rec.key)
+    pos++;
+  memmove(&history[pos + 1], &history[pos],
+          (history_count - pos) * sizeof(LaunchRecord));
+  history[pos] = rec;
+  history_count++;
+}
+
+/* launches weighted by how long ago the latest one was */
+static uint32_t frecency(const App *a, uint32_t now) {
+  LaunchRecord *r = history_find(app_key(a));
+  if (!r)
+    return 0;
+  uint32_t days = now > r->last ? (now - r->last) / 86400 : 0;
+  uint32_t w = days < 4    ? 100
+               : days < 14 ? 70
+               : days < 31 ? 50
+               : days < 90 ? 30
+                           : 10;
+  return r->count * w;
+}
+
+/* ---------- search index ---------- */
+
+/* the apps in rank order (frecency, then list order), case-folded copies
+   of their names and commands, and the sorted (trigram << 32 | rank) pairs
+   over them, rebuilt whenever the app list or the history changes. A filter
+   of three or more characters only visits the apps that contain its rarest
+   trigram, and every path yields its matches already ranked. The result for
+   the current filter is cached: navigation keys reuse it and typing narrows
+   it instead of starting over */
+static int *by_rank = NULL;  /* rank -> app */
+static int *rank_pos = NULL; /* app -> rank */
+static char *fold_buf = NULL;
+static size_t fold_len = 0, fold_cap = 0;
+static uint32_t *fold_name = NULL, *fold_cmd = NULL; /* offsets, by rank */
+static int fold_apps_cap = 0;
+static uint64_t *tri_pairs = NULL;
+static size_t tri_count = 0, tri_cap = 0;
+
+static int cached_count = 0;
+static int matches_valid = 0;
+static char matched_filter[FILTER_MAX]; /* folded */
+
+static uint32_t fold_add(const char *s) {
+  size_t n = strlen(s) + 1;
+  if (fold_len + n > fold_cap) {
+    fold_cap = (fold_len + n) * 2;
+    fold_buf = realloc(fold_buf, fold_cap);
+    if (!fold_buf)
+      exit(2);
+  }
+  for (size_t i = 0; i < n; ++i)
+    fold_buf[fold_len + i] = (char)tolower((unsigned char)s[i]);
+  fold_len += n;
+  return (uint32_t)(fold_len - n);
+}
+
+static uint32_t trigram(const char *p) {
+  return (uint32_t)(unsigned char)p[0] << 16 |
+         (uint32_t)(unsigned char)p[1] << 8 | (unsigned char)p[2];
+}
+
+static void add_trigrams(const char *s, int rank) {
+  for (; s[0] && s[1] && s[2]; ++s) {
+    if (tri_count == tri_cap) {
+      tri_cap = tri_cap ? tri_cap * 2 : 4096;
+      tri_pairs = realloc(tri_pairs, tri_cap * sizeof(uint64_t));
+      if (!tri_pairs)
+        exit(2);
+    }
+    tri_pairs[tri_count++] = (uint64_t)trigram(s) << 32 | (uint32_t)rank;
+  }
+}
+
+static int u64_cmp(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static int rank_cmp(const void *a, const void *b) {
+  int x = *(const int *)a, y = *(const int *)b;
+  if (apps[x].frecency != apps[y].frecency)
+    return apps[x].frecency > apps[y].frecency ? -1 : 1;
+  return x - y;
+}
+
+static void build_search_index(void) {
+  if (app_count > fold_apps_cap) {
+    fold_apps_cap = app_cap;
+    by_rank = realloc(by_rank, fold_apps_cap * sizeof(int));
+    rank_pos = realloc(rank_pos, fold_apps_cap * sizeof(int));
+    fold_name = realloc(fold_name, fold_apps_cap * sizeof(uint32_t));
+    fold_cmd = realloc(fold_cmd, fold_apps_cap * sizeof(uint32_t));
+    if (!by_rank || !rank_pos || !fold_name || !fold_cmd)
+      exit(2);
+  }
+  uint32_t now = (uint32_t)time(NULL);
+  for (int i = 0; i < app_count; ++i) {
+    apps[i].frecency = frecency(&apps[i], now);
+    by_rank[i] = i;
+  }
+  if (app_count)
+    qsort(by_rank, app_count, sizeof(int), rank_cmp);
+
+  fold_len = 0;
+  tri_count = 0;
+  for (int r = 0; r < app_count; ++r) {
+    rank_pos[by_rank[r]] = r;
+    fold_name[r] = fold_add(apps[by_rank[r]].name);
+    fold_cmd[r] = fold_add(apps[by_rank[r]].cmd);
+    add_trigrams(fold_buf + fold_name[r], r);
+    add_trigrams(fold_buf + fold_cmd[r], r);
+  }
+  /* sorted by trigram, then rank; a rank is listed once per trigram */
+  qsort(tri_pairs, tri_count, sizeof(uint64_t), u64_cmp);
+  size_t n = 0;
+  for (size_t i = 0; i < tri_count; ++i)
+    if (!n || tri_pairs[i] != tri_pairs[n - 1])
+      tri_pairs[n++] = tri_pairs[i];
+  tri_count = n;
+  matches_valid = 0;
+  first_frame_valid = 0;
+}
+
+/* first pair >= key */
+static size_t tri_lower(uint64_t key) {
+  size_t lo = 0, hi = tri_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (tri_pairs[mid] < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static int rank_matches(int r, const char *needle) {
+  return apps[by_rank[r]].valid && (strstr(fold_buf + fold_name[r], needle) ||
+                                    strstr(fold_buf + fold_cmd[r], needle));
+}
+
+/* fill match_buf with the apps whose name or command contains the filter,
+   best ranked first; returns their number */
+static int build_matches(void) {
+  char needle[FILTER_MAX];
+  size_t len = 0;
+  for (; filter_text[len]; ++len)
+    needle[len] = (char)tolower((unsigned char)filter_text[len]);
+  needle[len] = 0;
+  if (matches_valid && !strcmp(matched_filter, needle))
+    return cached_count;
+
+  int n = 0;
+  if (matches_valid && strstr(needle, matched_filter)) {
+    /* the filter grew: only the previous matches can still match */
+    for (int k = 0; k < cached_count; ++k)
+      if (rank_matches(rank_pos[match_buf[k]], needle))
+        match_buf[n++] = match_buf[k];
+  } else if (len >= 3) {
+    size_t best_lo = 0, best_hi = 0, best = (size_t)-1;
+    for (size_t i = 0; i + 3 <= len && best; ++i) {
+      uint64_t t = trigram(needle + i);
+      size_t lo = tri_lower(t << 32), hi = tri_lower((t + 1) << 32);
+      if (hi - lo < best) {
+        best = hi - lo;
+        best_lo = lo;
+        best_hi = hi;
+      }
+    }
+    for (size_t k = best_lo; k < best_hi; ++k) {
+      int r = (int)(uint32_t)tri_pairs[k];
+      if (rank_matches(r, needle))
+        match_buf[n++] = by_rank[r];
+    }
+  } else {
+    for (int r = 0; r < app_count; ++r)
+      if (rank_matches(r, needle))
+        match_buf[n++] = by_rank[r];
+  }
+  cached_count = n;
+  matches_valid = 1;
+  memcpy(matched_filter, needle, len + 1);
+  return n;
+}
+
+extern char **environ;
+
+/* split a plain command on blanks into argv (pointing into buf); returns 0
+   when it needs /bin/sh: quoting, expansion, redirection, assignments */
+static int split_command(const char *cmd, char *buf, size_t bufsz,
+                         char **argv, int max_args) {
+  if (strpbrk(cmd, "|&;<>()$`\\\"'*?[]#~{}!\n") ||
+      strlen(cmd) >= bufsz)
+    return 0;
+  strcpy(buf, cmd);
+  int argc = 0;
+  for (char *p = strtok(buf, " \t"); p; p = strtok(NULL, " \t")) {
+    if (argc == max_args - 1)
+      return 0;
+    argv[argc++] = p;
+  }
+  argv[argc] = NULL;
+  return argc > 0 && !strchr(argv[0], '=');
+}
+
+/* start cmd in its own session. posix_spawn does not copy the launcher the
+   way fork() does, and children are reaped by the kernel (SA_NOCLDWAIT) */
+static void spawn_command(const char *cmd) {
+  char buf[512];
+  char *argv[64];
+  char *sh_argv[] = {"sh", "-c", (char *)cmd, NULL};
+  const char *file = "/bin/sh";
+  if (split_command(cmd, buf, sizeof(buf), argv, 64))
+    file = argv[0];
+  else
+    memcpy(argv, sh_argv, sizeof(sh_argv));
+
+  posix_spawnattr_t attr;
+  sigset_t none;
+  sigemptyset(&none);
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setsigmask(&attr, &none);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGMASK);
+  pid_t pid;
+  int err = posix_spawnp(&pid, file, NULL, &attr, argv, environ);
+  if (err)
+    fprintf(stderr, "x11kickstart: %s: %s\n", argv[0], strerror(err));
+  posix_spawnattr_destroy(&attr);
+}
+
+static void launch_app(const App *a) {
+  history_record(a);
+  spawn_command(a->cmd);
+  animate_shrink();
+  hide_overlays();
+  /* re-rank while hidden, not on the next keystroke */
+  build_search_index();
+}
+
+/* labels are laid out once per app and kept until the cell width or the
+   font metrics change, which bumps label_gen */
+static uint32_t label_gen = 0;
+static int label_cell_w = 0, label_font_h = 0, label_font_adv = 0;
+
+static void label_geometry(Overlay *ov, int cell_w) {
+  XftFont *f = ov->xft_font;
+  if (label_gen && cell_w == label_cell_w && f->height == label_font_h &&
+      f->max_advance_width == label_font_adv)
+    return;
+  label_cell_w = cell_w;
+  label_font_h = f->height;
+  label_font_adv = f->max_advance_width;
+  if (++label_gen == 0)
+    label_gen = 1;
+}
+
+static int text_width(Overlay *ov, const char *s, int len) {
+  XGlyphInfo ext;
+  XftTextExtentsUtf8(dpy, ov->xft_font, (FcChar8 *)s, len, &ext);
+  return ext.width;
+}
+
+/* find the longest prefix of the name, cut at a character boundary, that
+   fits into maxw with an ellipsis appended */
+static void layout_label(Overlay *ov, App *a, int maxw) {
+  int len = strlen(a->name);
+  a->label_gen = label_gen;
+  a->label_len = len;
+  a->label_w = text_width(ov, a->name, len);
+  if (a->label_w <= maxw)
+    return;
+
+  int cuts[MAX_LABEL], ncuts = 0;
+  for (int i = 1; i < len; ++i)
+    if (((unsigned char)a->name[i] & 0xc0) != 0x80)
+      cuts[ncuts++] = i;
+  char buf[MAX_LABEL + 3];
+  int lo = 0, hi = ncuts; /* cuts[lo - 1] fits, cuts[hi] does not */
+  a->label_w = -1;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2, n = cuts[mid];
+    memcpy(buf, a->name, n);
+    memcpy(buf + n, "...", 3);
+    int w = text_width(ov, buf, n + 3);
+    if (w <= maxw) {
+      a->label_len = n;
+      a->label_w = w;
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+}
+
+static void draw_label_truncated_centered(Overlay *ov, App *a, int cell_x,
+                                          int cell_w, int baseline_y) {
+  label_geometry(ov, cell_w);
+  if (a->label_gen != label_gen)
+    layout_label(ov, a, cell_w - 12);
+  if (a->label_w < 0)
+    return;
+  char buf[MAX_LABEL + 3];
+  int n = a->label_len;
+  memcpy(buf, a->name, n);
+  if (a->name[n]) {
+    memcpy(buf + n, "...", 3);
+    n += 3;
+  }
+  int x = cell_x + (cell_w - a->label_w) / 2;
+  XftDrawStringUtf8(ov->xft_draw, &ov->xft_color_text, ov->xft_font, x,
+                    baseline_y, (FcChar8 *)buf, n);
 }
 
 static void ensure_selection_visible(int *match_indices, int match_count,
@@ -709,30 +2388,12 @@ static void ensure_selection_visible(int *match_indices, int match_count,
     scroll_row = 0;
 }
 
-static void draw_overlay_contents(void) {
-  if (!overlay_visible)
-    return;
-
-  int match_indices[MAX_APPS];
-  int match_count = build_matches(match_indices);
-  if (match_count == 0) {
-    selected_index = -1;
-  } else {
-    int found = 0;
-    for (int i = 0; i < match_count; ++i) {
-      if (match_indices[i] == selected_index) {
-        found = 1;
-        break;
-      }
-    }
-    if (!found)
-      selected_index = match_indices[0];
-  }
-
+/* draw the current page into every overlay's frame */
+static void render_frames(int *match_indices, int match_count) {
   for (int o = 0; o < overlay_count; ++o) {
     Overlay *ov = &overlays[o];
 
-    if (ov->bg_picture && ov->win_picture && ov->bg_w && ov->bg_h) {
+    if (ov->bg_picture && ov->frame_picture && ov->bg_w && ov->bg_h) {
       XTransform tr;
       double sx = (double)ov->bg_w / (double)ov->w;
       double sy = (double)ov->bg_h / (double)ov->h;
@@ -742,12 +2403,13 @@ static void draw_overlay_contents(void) {
       tr.matrix[2][2] = XDoubleToFixed(1.0);
       XRenderSetPictureTransform(dpy, ov->bg_picture, &tr);
       XRenderSetPictureFilter(dpy, ov->bg_picture, "bilinear", NULL, 0);
-      XRenderComposite(dpy, PictOpSrc, ov->bg_picture, None, ov->win_picture,
+      XRenderComposite(dpy, PictOpSrc, ov->bg_picture, None, ov->frame_picture,
                        0, 0, 0, 0, 0, 0, ov->w, ov->h);
     }
 
     /* draw bottom-right decoration above bg but below everything else */
-    if (shared_add_picture && shared_add_w && shared_add_h && ov->win_picture) {
+    if (shared_add_picture && shared_add_w && shared_add_h &&
+        ov->frame_picture) {
       int margin = 5;
       int dest_w = (int)shared_add_w;
       int dest_h = (int)shared_add_h;
@@ -758,7 +2420,7 @@ static void draw_overlay_contents(void) {
       /* no scaling: draw at native size */
       XRenderComposite(dpy, PictOpOver,
                        shared_add_picture, None,
-                       ov->win_picture,
+                       ov->frame_picture,
                        0, 0, 0, 0,
                        dest_x, dest_y,
                        dest_w, dest_h);
@@ -796,7 +2458,7 @@ static void draw_overlay_contents(void) {
       int cy = top + row * cell_h;
 
       if (app_idx == selected_index && shared_sel_picture &&
-          shared_sel_w && shared_sel_h && ov->win_picture) {
+          shared_sel_w && shared_sel_h && ov->frame_picture) {
         XTransform tr;
         double sx = (double)shared_sel_w / (double)(cell_w);
         double sy = (double)shared_sel_h / (double)(cell_h);
@@ -808,7 +2470,7 @@ static void draw_overlay_contents(void) {
         XRenderSetPictureFilter(dpy, shared_sel_picture, "bilinear", NULL, 0);
         XRenderComposite(dpy, PictOpOver,
                          shared_sel_picture, None,
-                         ov->win_picture,
+                         ov->frame_picture,
                          0, 0, 0, 0,
                          cx, cy,
                          cell_w, cell_h);
@@ -817,19 +2479,13 @@ static void draw_overlay_contents(void) {
       /* center icon horizontally */
       int icon_x = cx + (cell_w - ICON_SIZE) / 2;
       int icon_y = cy + CELL_PAD_TOP;
-      if (a->icon_picture && a->icon_w && a->icon_h && ov->win_picture) {
-        XTransform tr;
-        double sx = (double)a->icon_w / (double)ICON_SIZE;
-        double sy = (double)a->icon_h / (double)ICON_SIZE;
-        memset(&tr, 0, sizeof(tr));
-        tr.matrix[0][0] = XDoubleToFixed(sx);
-        tr.matrix[1][1] = XDoubleToFixed(sy);
-        tr.matrix[2][2] = XDoubleToFixed(1.0);
-        XRenderSetPictureTransform(dpy, a->icon_picture, &tr);
-        XRenderSetPictureFilter(dpy, a->icon_picture, "best", NULL, 0);
-        XRenderComposite(dpy, PictOpOver, a->icon_picture, None,
-                         ov->win_picture, 0, 0, 0, 0,
-                         icon_x, icon_y, ICON_SIZE, ICON_SIZE);
+      ensure_app_icon(a);
+      if (a->icon_slot >= 0 && ov->frame_picture) {
+        Picture atlas;
+        int ax, ay;
+        atlas_cell(a->icon_slot, &atlas, &ax, &ay);
+        XRenderComposite(dpy, PictOpOver, atlas, None, ov->frame_picture, ax,
+                         ay, 0, 0, icon_x, icon_y, ICON_SIZE, ICON_SIZE);
       } else {
         XGlyphInfo qext;
         XftTextExtentsUtf8(dpy, ov->xft_font, (FcChar8 *)"?", 1, &qext);
@@ -841,7 +2497,7 @@ static void draw_overlay_contents(void) {
 
       /* center label horizontally under icon */
       int label_y = icon_y + ICON_SIZE + ov->xft_font->ascent + 2 + CELL_PAD_TOP;
-      draw_label_truncated_centered(ov, a->name, cx, cell_w, label_y);
+      draw_label_truncated_centered(ov, a, cx, cell_w, label_y);
     }
 
     int total_rows = (match_count + cols - 1) / cols;
@@ -853,25 +2509,82 @@ static void draw_overlay_contents(void) {
           top + (scroll_row * (ov->h - top - margin - bar_h)) /
                     (total_rows - rows_visible);
       XRenderColor sc = {0xffff, 0xffff, 0xffff, 0x9999};
-      if (ov->win_picture)
-        XRenderFillRectangle(dpy, PictOpOver, ov->win_picture, &sc,
+      if (ov->frame_picture)
+        XRenderFillRectangle(dpy, PictOpOver, ov->frame_picture, &sc,
                              ov->w - margin / 2, bar_y, 4, bar_h);
     }
 
-    draw_gradient_border(ov->w, ov->h, dpy, ov->win);
+    draw_gradient_border(ov->w, ov->h, dpy, ov->frame);
+  }
+}
+
+static void present_frames(void) {
+  for (int o = 0; o < overlay_count; ++o) {
+    Overlay *ov = &overlays[o];
+    XCopyArea(dpy, ov->frame, ov->win, ov->gc, 0, 0, ov->w, ov->h, 0, 0);
+  }
+  XFlush(dpy);
+}
+
+/* whether the first page of the unfiltered list is what would be drawn */
+static int at_first_page(int *match_indices, int match_count) {
+  return filter_len == 0 && scroll_row == 0 &&
+         selected_index == (match_count ? match_indices[0] : -1);
+}
+
+static void draw_overlay_contents(void) {
+  if (!overlay_visible)
+    return;
+
+  int *match_indices = match_buf;
+  int match_count = build_matches();
+  if (match_count == 0) {
+    selected_index = -1;
+  } else {
+    int found = 0;
+    for (int i = 0; i < match_count; ++i) {
+      if (match_indices[i] == selected_index) {
+        found = 1;
+        break;
+      }
+    }
+    if (!found)
+      selected_index = match_indices[0];
+  }
 
-    XFlush(dpy);
+  int first = at_first_page(match_indices, match_count);
+  if (!first || !first_frame_valid) {
+    render_frames(match_indices, match_count);
+    first_frame_valid = first;
   }
+  present_frames();
 
   if (match_count == 1) {
     int idx = match_indices[0];
-    launch_app(apps[idx].cmd);
+    launch_app(&apps[idx]);
   }
 }
 
+/* while hidden, draw the first page ahead of the next Ctrl+R, so showing
+   the launcher is a map and a copy. Returns 1 when it drew */
+static int prerender_first_frame(void) {
+  if (overlay_visible)
+    return 0;
+  update_layout();
+  if (first_frame_valid || !overlay_count)
+    return 0;
+  int match_count = build_matches();
+  selected_index = match_count ? match_buf[0] : -1;
+  scroll_row = 0;
+  render_frames(match_buf, match_count);
+  XFlush(dpy);
+  first_frame_valid = 1;
+  return 1;
+}
+
 static void move_selection(int dx, int dy) {
-  int match_indices[MAX_APPS];
-  int match_count = build_matches(match_indices);
+  int *match_indices = match_buf;
+  int match_count = build_matches();
   if (match_count == 0)
     return;
 
@@ -935,6 +2648,12 @@ int main(int argc, char **argv) {
 
   screen = DefaultScreen(dpy);
   root = RootWindow(dpy, screen);
+  fcntl(ConnectionNumber(dpy), F_SETFD, FD_CLOEXEC);
+
+  /* launched apps are never waited for; let the kernel reap them */
+  struct sigaction sa = {.sa_handler = SIG_DFL, .sa_flags = SA_NOCLDWAIT};
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGCHLD, &sa, NULL);
 
   XVisualInfo vinfo;
   if (!XMatchVisualInfo(dpy, screen, 32, TrueColor, &vinfo)) {
@@ -969,16 +2688,50 @@ int main(int argc, char **argv) {
   if (shared_add_pixmap)
     shared_add_picture = picture_from_pixmap(shared_add_pixmap);
 
+  icache_open();
+  history_open();
   load_apps_from_file();
-  
+  load_desktop_entries();
+  watch_sources();
+  build_search_index();
+  create_overlays();
+  XSelectInput(dpy, root, StructureNotifyMask);
+
   grab_ctrl_r();
 
   for (;;) {
+    /* wait for X or for decoded icons, which fill in as they arrive */
+    while (!XPending(dpy)) {
+      if (prerender_first_frame())
+        continue;
+      /* poll skips the descriptors that are -1 */
+      struct pollfd pfds[3] = {{ConnectionNumber(dpy), POLLIN, 0},
+                               {decode_efd, POLLIN, 0},
+                               {inotify_fd, POLLIN, 0}};
+      poll(pfds, 3, -1);
+      int redraw = 0;
+      if ((pfds[1].revents & POLLIN) && collect_decoded()) {
+        first_frame_valid = 0;
+        redraw = 1;
+      }
+      if ((pfds[2].revents & POLLIN) && handle_inotify()) {
+        build_search_index();
+        redraw = 1;
+      }
+      if (redraw && overlay_visible)
+        draw_overlay_contents();
+    }
     XEvent ev;
     XNextEvent(dpy, &ev);
     if (ev.type == Expose) {
+      /* the frames still hold the current page */
       if (overlay_visible)
-        draw_overlay_contents();
+        present_frames();
+    } else if (ev.type == ConfigureNotify) {
+      /* the root changes size with the monitor layout; the overlays
+         are rebuilt while they are hidden */
+      if (ev.xconfigure.window == root)
+        layout_dirty = 1;
     } else if (ev.type == KeyPress) {
       XKeyEvent *ke = &ev.xkey;
       KeySym ks = XLookupKeysym(ke, 0);
@@ -996,15 +2749,14 @@ int main(int argc, char **argv) {
         hide_overlays();
         continue;
       } else if (ks == XK_Return) {
-        int match_indices[MAX_APPS];
-        int match_count = build_matches(match_indices);
+        int match_count = build_matches();
         if (match_count > 0) {
           int idx = selected_index;
-          launch_app(apps[idx].cmd);
+          launch_app(&apps[idx]);
         }
       } else if (ks == XK_Tab) {
-        int match_indices[MAX_APPS];
-        int match_count = build_matches(match_indices);
+        int *match_indices = match_buf;
+        int match_count = build_matches();
         if (match_count > 0) {
           int pos = 0;
           for (int i = 0; i < match_count; ++i) {
@@ -5,11 +5,16 @@
 #include "verdana.ttf.h"
 #include <X11/Xatom.h>
 #include <X11/Xft/Xft.h>
+#include <X11/Xlib-xcb.h>
 #include <X11/Xlib.h>
+#include <X11/extensions/Xcomposite.h>
+#include <X11/extensions/Xdamage.h>
 #include <X11/extensions/Xinerama.h>
 #include <X11/extensions/Xrender.h>
 #include <X11/keysym.h>
 #include <png.h>
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
 
 #include <freetype2/freetype/freetype.h>
 #include <ft2build.h>
@@ -19,28 +24,68 @@
 
 #include <ctype.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
-#define MAX_CLIENTS 256
 #define MAX_LABEL 512
+#define EXEC_MAX 128
+#define ARENA_COMPACT_MIN (64 * 1024)
+#define PROC_CACHE_MAX 256
+
+#define MRU_FILE_MAGIC 0x3275726dU /* "mru2" */
+#define MRU_SLOTS 1024
+#define MRU_TOMBSTONE ((uint64_t)-1)
+#define MRU_TOMBSTONES_MAX (MRU_SLOTS / 4) /* rehash beyond this */
+
+#define STALE_TITLE 1
+#define STALE_PID 2
+#define STALE_STATE 4
+#define STALE_ICON 8
 #define FILTER_MAX 128
-#define ANIM_STEPS 20
+#define ANIM_STEPS 20 /* frames over ANIM_TOTAL_MS */
 #define ANIM_TOTAL_MS 200
+#define MAX_ROWS 15
+#define SCREENS_MAX 16 /* monitors the overlays are built for */
+#define THUMB_W 32
+#define THUMB_H 18
+#define THUMB_INTERVAL_MS 250 /* min time between two refreshes of a thumb */
+#define QUICK_TAP_MS 150      /* Alt released sooner: switch without overlay */
+#define ICON_SIZE 16
+#define ICON_PROP_MAX (1024 * 1024) /* bytes of _NET_WM_ICON we accept */
+#define LABEL_X (10 + ICON_SIZE + 6)
 
 typedef struct {
   Window win;
-  char label[MAX_LABEL];
-  char title[MAX_LABEL];
-  char execname[128];
+  uint32_t title;    /* offsets into the string arena */
+  uint32_t execname;
   pid_t pid;
-  int valid;
+  int valid; /* 0: listed by the WM but skip-taskbar */
+  unsigned stale; /* STALE_* properties changed since they were fetched */
+  /* live thumbnail, set up the first time the client is listed on screen
+     and kept until it leaves _NET_CLIENT_LIST */
+  Visual *visual;
+  int w, h;
+  int viewable; /* mapped: its contents can be captured */
+  Picture src_picture;
+  Pixmap thumb_pixmap;
+  Picture thumb_picture;
+  Damage damage;
+  int redirected; /* has a Composite backing pixmap */
+  int thumb_dirty;
+  double thumb_ms;
+  /* icon: 1-based index into the shared icon cache, 0 = none */
+  int icon;
+  int icon_pending;
+  xcb_get_property_cookie_t icon_cookie;
 } Client;
 
 typedef struct {
@@ -49,12 +94,19 @@ typedef struct {
   XftFont *xft_font;
   XftDraw *xft_draw;
   XftColor xft_color_text, xft_color_sel;
-  FT_Library ft_lib;
-  FT_Face ft_face;
-  Pixmap bg_pixmap;
-  Picture bg_picture;
   Picture win_picture;
-  unsigned bg_w, bg_h;
+  /* scaled background + corner decoration, built once per layout */
+  Pixmap base_pixmap;
+  Picture base_picture;
+  /* base plus filter line, unselected rows, thumbnails and border; the
+     window is repainted from it */
+  Pixmap frame_pixmap;
+  Picture frame_picture;
+  XftDraw *frame_draw;
+  /* selection image pre-scaled to one row */
+  Pixmap selbar_pixmap;
+  Picture selbar_picture;
+  int rows_top, rows_shown;
 } Overlay;
 
 XftFont *xft_font_from_memory(Display *dpy, int screen,
@@ -99,6 +151,7 @@ XftFont *xft_font_from_memory(Display *dpy, int screen,
 }
 
 static Display *dpy;
+static xcb_connection_t *xcb;
 static int screen;
 static Window root;
 static Atom net_client_list;
@@ -106,22 +159,44 @@ static Atom net_active_window;
 static Atom net_wm_name;
 static Atom utf8_string;
 static Atom net_wm_pid;
-
-static Client clients[MAX_CLIENTS];
+static Atom net_wm_state;
+static Atom net_wm_state_skip_taskbar;
+static Atom net_wm_icon;
+
+/* client records are unordered and reused on removal; MRU order lives in
+   mru[], a permutation of record indices, with mru_pos[] its inverse and
+   shown_rank[] the number printed in front of a shown client */
+static Client *clients = NULL;
+static int *mru = NULL;
+static int *mru_pos = NULL;
+static int *shown_rank = NULL;
 static int client_count = 0;
+static int client_cap = 0;
 
 static Overlay *overlays = NULL;
 static int overlay_count = 0;
 
 static int visible = 0;
 
+/* font is opened once and shared by every overlay */
+static XftFont *shared_font = NULL;
+static FT_Library shared_ft_lib = NULL;
+static FT_Face shared_ft_face = NULL;
+
+/* set when the root window is resized, i.e. the monitor layout changed */
+static int layout_dirty = 0;
+
+/* thumbnails need both Composite and Damage */
+static int have_thumbs = 0;
+static int damage_event_base = 0;
+
 /* shared background pixmap loaded once */
 static Pixmap shared_bg_pixmap = 0;
 static unsigned shared_bg_w = 0, shared_bg_h = 0;
 /* selection (sticky) image loaded once */
 static Pixmap shared_sel_pixmap = 0;
 static unsigned shared_sel_w = 0, shared_sel_h = 0;
-/* picture for the selection image (created in create_overlays) */
+/* picture for the selection image (created once in main) */
 static Picture shared_sel_picture = 0;
 
 /* additional overlay image (bottom-right decoration) loaded once */
@@ -136,34 +211,33 @@ static int depth;
 static char filter_text[FILTER_MAX] = {0};
 static int filter_len = 0;
 static int overlay_visible = 0;
+/* the overlay frame layers show the current match list */
+static int frame_valid = 0;
 
 /* index in clients[] of the currently highlighted item */
 static int selected_index = 0;
 
 static void set_font(Overlay *app) {
-  if (!FcInit())
-    exit(2);
-
-  double pixel_size = 10.0;
-  app->xft_font =
-      xft_font_from_memory(dpy, screen, verdana_ttf, (size_t)verdana_ttf_len,
-                           pixel_size, &app->ft_lib, &app->ft_face);
-  if (!app->xft_font)
-    exit(2);
-
-  // Get the visual + colormap actually used by the window
-  XWindowAttributes wa;
-  XGetWindowAttributes(dpy, app->win, &wa);
+  if (!shared_font) {
+    if (!FcInit())
+      exit(2);
+    double pixel_size = 10.0;
+    shared_font =
+        xft_font_from_memory(dpy, screen, verdana_ttf, (size_t)verdana_ttf_len,
+                             pixel_size, &shared_ft_lib, &shared_ft_face);
+    if (!shared_font)
+      exit(2);
+  }
+  app->xft_font = shared_font;
 
-  app->xft_draw = XftDrawCreate(dpy, app->win, wa.visual, wa.colormap);
+  /* overlays are created with our own visual + colormap */
+  app->xft_draw = XftDrawCreate(dpy, app->win, visual, colormap);
   if (!app->xft_draw)
     exit(2);
 
-  if (!XftColorAllocName(dpy, wa.visual, wa.colormap, "white",
-                         &app->xft_color_text))
+  if (!XftColorAllocName(dpy, visual, colormap, "white", &app->xft_color_text))
     exit(2);
-  if (!XftColorAllocName(dpy, wa.visual, wa.colormap, "gray80",
-                         &app->xft_color_sel))
+  if (!XftColorAllocName(dpy, visual, colormap, "gray80", &app->xft_color_sel))
     exit(2);
 }
 
@@ -402,56 +476,719 @@ static void read_proc_execname(pid_t pid, char *buf, size_t bufsz) {
   snprintf(buf, bufsz, "unknown");
 }
 
-static int strcasestr_simple(const char *hay, const char *needle) {
-  if (!needle[0])
+static int is_word_start(const char *hay, const char *p) {
+  if (p == hay)
     return 1;
-  size_t hl = strlen(hay);
-  size_t nl = strlen(needle);
-  for (size_t i = 0; i + nl <= hl; ++i) {
-    size_t j = 0;
-    for (; j < nl; ++j) {
-      char c1 = tolower((unsigned char)hay[i + j]);
-      char c2 = tolower((unsigned char)needle[j]);
-      if (c1 != c2)
+  unsigned char prev = (unsigned char)p[-1], cur = (unsigned char)*p;
+  return !isalnum(prev) || (islower(prev) && isupper(cur));
+}
+
+/* case-insensitive subsequence match; -1 when needle is not a subsequence of
+   hay, otherwise a score that rewards word starts and consecutive runs */
+static int fuzzy_score(const char *hay, const char *needle) {
+  if (!needle[0])
+    return 0;
+  int best = -1;
+  int first = tolower((unsigned char)needle[0]);
+  /* try every possible anchor for the first character and keep the best
+     greedy completion; labels are short so this stays cheap */
+  for (const char *start = hay; *start; ++start) {
+    if (tolower((unsigned char)*start) != first)
+      continue;
+    const char *h = start;
+    int score = 0, run = 0;
+    const char *n = needle;
+    for (; *n; ++n) {
+      int c = tolower((unsigned char)*n);
+      int gap = 0;
+      while (*h && tolower((unsigned char)*h) != c) {
+        h++;
+        gap++;
+      }
+      if (!*h)
         break;
+      run = (gap == 0 && n != needle) ? run + 1 : 0;
+      score += 1 + run * 4 - (gap < 3 ? gap : 3);
+      if (is_word_start(hay, h))
+        score += 8;
+      h++;
     }
-    if (j == nl)
-      return 1;
+    if (*n)
+      break; /* later anchors cannot complete either */
+    if (start == hay)
+      score += 4;
+    if (score > best)
+      best = score;
   }
-  return 0;
+  return best;
 }
 
-/* ---------- clients / MRU ---------- */
+/* ---------- thumbnails ---------- */
+
+/* each client gets a small ARGB picture holding its scaled-down contents.
+   It is rendered from the window (backed by its Composite pixmap) only when
+   Damage says the window changed, and damage is reported as NonEmpty so a
+   window costs at most one event between two refreshes, even while the
+   overlay is hidden. A client is redirected offscreen the first time it
+   is listed on screen while mapped and stays so until it leaves the client
+   list, so showing the overlay again neither re-allocates its backing
+   pixmap nor captures it before the client has repainted */
+
+static void release_thumb(Client *c) {
+  if (c->redirected)
+    XCompositeUnredirectWindow(dpy, c->win, CompositeRedirectAutomatic);
+  c->redirected = 0;
+  if (c->damage)
+    XDamageDestroy(dpy, c->damage);
+  if (c->src_picture)
+    XRenderFreePicture(dpy, c->src_picture);
+  if (c->thumb_picture)
+    XRenderFreePicture(dpy, c->thumb_picture);
+  if (c->thumb_pixmap)
+    XFreePixmap(dpy, c->thumb_pixmap);
+  c->damage = 0;
+  c->src_picture = 0;
+  c->thumb_picture = 0;
+  c->thumb_pixmap = 0;
+}
 
-static int ignore_badwindow(Display *d, XErrorEvent *e) {
-  if (e->error_code == BadWindow)
+static void ensure_thumb(Client *c, double now) {
+  if (!have_thumbs || !c->visual || !c->viewable || c->thumb_picture)
+    return;
+  XRenderPictFormat *src_fmt = XRenderFindVisualFormat(dpy, c->visual);
+  XRenderPictFormat *argb_fmt =
+      XRenderFindStandardFormat(dpy, PictStandardARGB32);
+  if (!src_fmt || !argb_fmt)
+    return;
+  XCompositeRedirectWindow(dpy, c->win, CompositeRedirectAutomatic);
+  c->redirected = 1;
+  XRenderPictureAttributes pa;
+  pa.subwindow_mode = IncludeInferiors;
+  c->src_picture =
+      XRenderCreatePicture(dpy, c->win, src_fmt, CPSubwindowMode, &pa);
+  XRenderSetPictureFilter(dpy, c->src_picture, "bilinear", NULL, 0);
+  c->thumb_pixmap = XCreatePixmap(dpy, root, THUMB_W, THUMB_H, 32);
+  c->thumb_picture =
+      XRenderCreatePicture(dpy, c->thumb_pixmap, argb_fmt, 0, NULL);
+  XRenderColor clear = {0, 0, 0, 0};
+  XRenderFillRectangle(dpy, PictOpSrc, c->thumb_picture, &clear, 0, 0, THUMB_W,
+                       THUMB_H);
+  c->damage = XDamageCreate(dpy, c->win, XDamageReportNonEmpty);
+  /* the fresh backing pixmap is only filled once the client repaints after
+     the Expose the redirect causes: stay blank for one interval */
+  c->thumb_dirty = 1;
+  c->thumb_ms = now;
+}
+
+/* scale the window into its thumbnail, keeping the aspect ratio */
+static void render_thumb(Client *c, double now) {
+  if (!c->thumb_picture || c->w <= 0 || c->h <= 0)
+    return;
+  int tw = THUMB_W, th = THUMB_H;
+  if (c->w * THUMB_H > c->h * THUMB_W)
+    th = c->h * THUMB_W / c->w;
+  else
+    tw = c->w * THUMB_H / c->h;
+  if (tw < 1)
+    tw = 1;
+  if (th < 1)
+    th = 1;
+
+  XRenderColor clear = {0, 0, 0, 0};
+  XRenderFillRectangle(dpy, PictOpSrc, c->thumb_picture, &clear, 0, 0, THUMB_W,
+                       THUMB_H);
+  XTransform tr;
+  memset(&tr, 0, sizeof(tr));
+  tr.matrix[0][0] = XDoubleToFixed((double)c->w / (double)tw);
+  tr.matrix[1][1] = XDoubleToFixed((double)c->h / (double)th);
+  tr.matrix[2][2] = XDoubleToFixed(1.0);
+  XRenderSetPictureTransform(dpy, c->src_picture, &tr);
+  XRenderComposite(dpy, PictOpSrc, c->src_picture, None, c->thumb_picture, 0,
+                   0, 0, 0, (THUMB_W - tw) / 2, (THUMB_H - th) / 2, tw, th);
+  /* re-arm the NonEmpty damage report */
+  XDamageSubtract(dpy, c->damage, None, None);
+  c->thumb_dirty = 0;
+  c->thumb_ms = now;
+}
+
+/* ---------- window icons ---------- */
+
+/* _NET_WM_ICON is requested through XCB when a window appears or the
+   property changes, and the reply is picked up without blocking whenever it
+   has arrived, so the draw path never waits for it. The best fitting size is
+   premultiplied and scaled once to ICON_SIZE; identical results (several
+   windows of one application) share one Picture */
+typedef struct {
+  uint32_t hash;
+  int refs;
+  Pixmap pixmap;
+  Picture picture;
+  uint32_t argb[ICON_SIZE * ICON_SIZE]; /* to confirm a hash match */
+} IconEntry;
+
+static IconEntry *icons = NULL;
+static int icon_count = 0, icon_cap = 0;
+
+static void icon_unref(int icon) {
+  if (!icon)
+    return;
+  IconEntry *e = &icons[icon - 1];
+  if (--e->refs > 0)
+    return;
+  XRenderFreePicture(dpy, e->picture);
+  XFreePixmap(dpy, e->pixmap);
+  memset(e, 0, sizeof(*e));
+}
+
+static void release_icon(Client *c) {
+  if (c->icon_pending)
+    xcb_discard_reply(xcb, c->icon_cookie.sequence);
+  c->icon_pending = 0;
+  icon_unref(c->icon);
+  c->icon = 0;
+}
+
+static void request_icon(Client *c) {
+  if (c->icon_pending)
+    xcb_discard_reply(xcb, c->icon_cookie.sequence);
+  c->icon_cookie = xcb_get_property(xcb, 0, c->win, net_wm_icon, XA_CARDINAL,
+                                    0, ICON_PROP_MAX / 4);
+  c->icon_pending = 1;
+}
+
+/* pick the smallest image that is at least ICON_SIZE, else the largest */
+static const uint32_t *pick_icon(const uint32_t *v, size_t n, uint32_t *ow,
+                                 uint32_t *oh) {
+  const uint32_t *best = NULL;
+  uint32_t bw = 0, bh = 0;
+  for (size_t i = 0; i + 2 <= n;) {
+    uint32_t w = v[i], h = v[i + 1];
+    if (!w || !h || w > 4096 || h > 4096 || (size_t)w * h > n - i - 2)
+      break;
+    int fits = w >= ICON_SIZE && h >= ICON_SIZE;
+    int best_fits = bw >= ICON_SIZE && bh >= ICON_SIZE;
+    if (!best || (fits && (!best_fits || w * h < bw * bh)) ||
+        (!fits && !best_fits && w * h > bw * bh)) {
+      best = v + i + 2;
+      bw = w;
+      bh = h;
+    }
+    i += 2 + (size_t)w * h;
+  }
+  *ow = bw;
+  *oh = bh;
+  return best;
+}
+
+/* box-filter the icon to ICON_SIZE x ICON_SIZE, premultiplying on the way */
+static void scale_icon(const uint32_t *src, uint32_t sw, uint32_t sh,
+                       uint32_t *dst) {
+  for (int y = 0; y < ICON_SIZE; ++y) {
+    uint32_t y0 = y * sh / ICON_SIZE, y1 = (y + 1) * sh / ICON_SIZE;
+    if (y1 <= y0)
+      y1 = y0 + 1;
+    for (int x = 0; x < ICON_SIZE; ++x) {
+      uint32_t x0 = x * sw / ICON_SIZE, x1 = (x + 1) * sw / ICON_SIZE;
+      if (x1 <= x0)
+        x1 = x0 + 1;
+      uint32_t a = 0, r = 0, g = 0, b = 0, n = 0;
+      for (uint32_t sy = y0; sy < y1; ++sy) {
+        for (uint32_t sx = x0; sx < x1; ++sx) {
+          uint32_t p = src[sy * sw + sx], pa = p >> 24;
+          a += pa;
+          r += ((p >> 16) & 0xff) * pa / 255;
+          g += ((p >> 8) & 0xff) * pa / 255;
+          b += (p & 0xff) * pa / 255;
+          n++;
+        }
+      }
+      dst[y * ICON_SIZE + x] =
+          (a / n) << 24 | (r / n) << 16 | (g / n) << 8 | (b / n);
+    }
+  }
+}
+
+/* find or create the cache entry for these pixels; returns its index + 1 */
+static int icon_intern(uint32_t *argb) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < ICON_SIZE * ICON_SIZE; ++i)
+    hash = (hash ^ argb[i]) * 16777619u;
+  int free_slot = -1;
+  for (int i = 0; i < icon_count; ++i) {
+    if (icons[i].refs && icons[i].hash == hash &&
+        !memcmp(icons[i].argb, argb, sizeof(icons[i].argb))) {
+      icons[i].refs++;
+      free(argb);
+      return i + 1;
+    }
+    if (!icons[i].refs && free_slot < 0)
+      free_slot = i;
+  }
+  if (free_slot < 0) {
+    if (icon_count == icon_cap) {
+      icon_cap = icon_cap ? icon_cap * 2 : 32;
+      icons = realloc(icons, icon_cap * sizeof(IconEntry));
+      if (!icons)
+        exit(2);
+    }
+    free_slot = icon_count++;
+  }
+
+  /* a grown slot holds garbage: clear it before anything can fail, so
+     the scan above finds it free next time */
+  IconEntry *e = &icons[free_slot];
+  memset(e, 0, sizeof(*e));
+  memcpy(e->argb, argb, sizeof(e->argb));
+  XImage *xi = XCreateImage(dpy, DefaultVisual(dpy, DefaultScreen(dpy)), 32,
+                            ZPixmap, 0, (char *)argb, ICON_SIZE, ICON_SIZE,
+                            32, 0);
+  if (!xi) {
+    free(argb);
     return 0;
-  return 1;
+  }
+  xi->byte_order = ImageByteOrder(dpy);
+  e->pixmap = XCreatePixmap(dpy, root, ICON_SIZE, ICON_SIZE, 32);
+  GC gc = XCreateGC(dpy, e->pixmap, 0, NULL);
+  XPutImage(dpy, e->pixmap, gc, xi, 0, 0, 0, 0, ICON_SIZE, ICON_SIZE);
+  XFreeGC(dpy, gc);
+  XDestroyImage(xi); /* also frees argb */
+  e->picture = XRenderCreatePicture(
+      dpy, e->pixmap, XRenderFindStandardFormat(dpy, PictStandardARGB32), 0,
+      NULL);
+  e->hash = hash;
+  e->refs = 1;
+  return free_slot + 1;
 }
 
-static int safe_attrs(Display *dpy, Window w, XWindowAttributes *wa) {
-  int (*old)(Display *, XErrorEvent *) = XSetErrorHandler(ignore_badwindow);
-  int ok = XGetWindowAttributes(dpy, w, wa);
-  XSync(dpy, False);
-  XSetErrorHandler(old);
-  return ok;
+static void set_icon(Client *c, xcb_get_property_reply_t *r) {
+  icon_unref(c->icon);
+  c->icon = 0;
+  if (!r || r->format != 32)
+    return;
+  uint32_t w, h;
+  const uint32_t *px = pick_icon(xcb_get_property_value(r),
+                                 xcb_get_property_value_length(r) / 4, &w, &h);
+  if (!px)
+    return;
+  uint32_t *argb = malloc(ICON_SIZE * ICON_SIZE * 4);
+  if (!argb)
+    exit(2);
+  scale_icon(px, w, h, argb);
+  c->icon = icon_intern(argb);
 }
 
-static int window_wants_ignored(Window w) {
-  static Atom net_wm_state, net_wm_state_skip_taskbar;
+/* take every icon reply that has arrived; returns 1 when one changed */
+static int collect_icons(void) {
+  int changed = 0;
+  for (int i = 0; i < client_count; ++i) {
+    Client *c = &clients[i];
+    if (!c->icon_pending)
+      continue;
+    void *reply = NULL;
+    xcb_generic_error_t *err = NULL;
+    if (!xcb_poll_for_reply(xcb, c->icon_cookie.sequence, &reply, &err))
+      continue;
+    c->icon_pending = 0;
+    free(err);
+    set_icon(c, reply);
+    free(reply);
+    changed = 1;
+  }
+  return changed;
+}
+
+/* ---------- string arena ---------- */
+
+/* titles and execnames are interned into one growable buffer and referred to
+   by offset; offset 0 is the empty string. Strings that are no longer used
+   are reclaimed by compacting once the arena has doubled */
+static char *arena = NULL;
+static size_t arena_used = 0, arena_cap = 0;
+static size_t arena_compact_at = ARENA_COMPACT_MIN;
+static uint32_t *intern_tab = NULL; /* offset + 1, 0 = empty slot */
+static size_t intern_cap = 0, intern_count = 0;
+
+static const char *str_at(uint32_t off) { return arena + off; }
+
+static uint32_t str_hash(const char *s) {
+  uint32_t h = 2166136261u;
+  while (*s)
+    h = (h ^ (unsigned char)*s++) * 16777619u;
+  return h;
+}
+
+static void intern_insert(uint32_t off) {
+  size_t mask = intern_cap - 1;
+  size_t i = str_hash(str_at(off)) & mask;
+  while (intern_tab[i])
+    i = (i + 1) & mask;
+  intern_tab[i] = off + 1;
+  intern_count++;
+}
+
+static void intern_rehash(size_t cap) {
+  free(intern_tab);
+  intern_tab = calloc(cap, sizeof(uint32_t));
+  if (!intern_tab)
+    exit(2);
+  intern_cap = cap;
+  intern_count = 0;
+}
+
+static uint32_t intern(const char *s) {
+  if (!arena) {
+    arena_cap = 4096;
+    arena = malloc(arena_cap);
+    if (!arena)
+      exit(2);
+    arena[0] = 0;
+    arena_used = 1;
+  }
+  if (!intern_tab)
+    intern_rehash(256);
+  if (!s[0])
+    return 0;
+
+  size_t mask = intern_cap - 1;
+  for (size_t i = str_hash(s) & mask; intern_tab[i]; i = (i + 1) & mask)
+    if (!strcmp(str_at(intern_tab[i] - 1), s))
+      return intern_tab[i] - 1;
+
+  size_t len = strlen(s) + 1;
+  if (arena_used + len > arena_cap) {
+    while (arena_used + len > arena_cap)
+      arena_cap *= 2;
+    arena = realloc(arena, arena_cap);
+    if (!arena)
+      exit(2);
+  }
+  uint32_t off = (uint32_t)arena_used;
+  memcpy(arena + off, s, len);
+  arena_used += len;
+
+  if ((intern_count + 1) * 2 > intern_cap) {
+    /* rebuild from the arena itself: every string in it is interned */
+    intern_rehash(intern_cap * 2);
+    for (size_t o = 1; o < arena_used; o += strlen(arena + o) + 1)
+      intern_insert((uint32_t)o);
+  } else {
+    intern_insert(off);
+  }
+  return off;
+}
+
+/* ---------- process names ---------- */
+
+/* browsers and terminals own dozens of windows under one PID, so execnames
+   are cached per process. A process is identified by (pid, start time) so a
+   reused PID is not mistaken for the old process. Where pidfd_open() exists
+   the entry holds a pidfd that the main loop polls; it becomes readable when
+   the process exits and the entry is evicted then */
+typedef struct {
+  pid_t pid;
+  unsigned long long start;
+  uint32_t execname;
+  int fd; /* pidfd, -1 when unavailable */
+} ProcEntry;
+
+static ProcEntry *procs = NULL;
+static int proc_count = 0, proc_cap = 0;
+
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+  (void)pid;
+  return -1;
+#endif
+}
 
+/* field 22 of /proc/PID/stat, in clock ticks since boot; 0 if unknown */
+static unsigned long long proc_start_time(pid_t pid) {
+  char path[64], buf[1024];
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return 0;
+  buf[n] = 0;
+  /* comm may contain spaces and parens, so count fields after the last ')' */
+  char *p = strrchr(buf, ')');
+  if (!p)
+    return 0;
+  p++;
+  for (int field = 3; field < 22 && p; ++field)
+    p = strchr(p + 1, ' ');
+  return p ? strtoull(p + 1, NULL, 10) : 0;
+}
+
+static void forget_proc(int i) {
+  if (procs[i].fd >= 0)
+    close(procs[i].fd);
+  procs[i] = procs[--proc_count];
+}
+
+/* whether the entry still describes the process running as its PID. A
+   pidfd does not keep the PID from being reused once the process exits,
+   but it turns readable at that point, before the exit event reaches the
+   main loop */
+static int proc_current(const ProcEntry *e) {
+  if (e->fd >= 0) {
+    struct pollfd pfd = {e->fd, POLLIN, 0};
+    return poll(&pfd, 1, 0) == 0;
+  }
+  return e->start == proc_start_time(e->pid);
+}
+
+static uint32_t proc_execname(pid_t pid) {
+  for (int i = 0; i < proc_count; ++i) {
+    if (procs[i].pid != pid)
+      continue;
+    if (proc_current(&procs[i]))
+      return procs[i].execname;
+    forget_proc(i);
+    break;
+  }
+
+  if (proc_count >= PROC_CACHE_MAX) {
+    /* entries without a pidfd are never evicted on exit; drop them first */
+    for (int i = proc_count - 1; i >= 0; --i)
+      if (procs[i].fd < 0)
+        forget_proc(i);
+    if (proc_count >= PROC_CACHE_MAX)
+      forget_proc(0);
+  }
+  if (proc_count == proc_cap) {
+    proc_cap = proc_cap ? proc_cap * 2 : 32;
+    procs = realloc(procs, proc_cap * sizeof(ProcEntry));
+    if (!procs)
+      exit(2);
+  }
+
+  /* open the pidfd first so the reads below see the same process */
+  ProcEntry *e = &procs[proc_count++];
+  e->pid = pid;
+  e->fd = open_pidfd(pid);
+  if (e->fd >= 0)
+    fcntl(e->fd, F_SETFD, FD_CLOEXEC);
+  e->start = proc_start_time(pid);
+  char buf[EXEC_MAX];
+  read_proc_execname(pid, buf, sizeof(buf));
+  e->execname = intern(buf);
+  return e->execname;
+}
+
+/* add the pidfds to a poll set; returns how many were added */
+static int proc_pollfds(struct pollfd *pfds) {
+  int n = 0;
+  for (int i = 0; i < proc_count; ++i) {
+    if (procs[i].fd < 0)
+      continue;
+    pfds[n].fd = procs[i].fd;
+    pfds[n].events = POLLIN;
+    pfds[n].revents = 0;
+    n++;
+  }
+  return n;
+}
+
+/* evict the processes whose pidfd reported an exit */
+static void reap_procs(const struct pollfd *pfds, int n) {
+  for (int k = 0; k < n; ++k) {
+    if (!pfds[k].revents)
+      continue;
+    for (int i = 0; i < proc_count; ++i) {
+      if (procs[i].fd == pfds[k].fd) {
+        forget_proc(i);
+        break;
+      }
+    }
+  }
+}
+
+/* ---------- persistent MRU ---------- */
+
+/* activation history survives restarts in a small fixed-layout file that is
+   mmap'd once; recording an activation is a couple of stores into the
+   mapping (clock_gettime goes through the vDSO), so the hot path makes no
+   syscalls and the kernel writes the page back on its own. Slots are an
+   open-addressed table keyed by window id; the PID guards against ids that
+   were reused after an X server restart. Deleted slots are left as
+   tombstones so probe chains stay intact, and the table is rehashed once
+   too many have piled up */
+typedef struct {
+  uint64_t win; /* 0: empty, MRU_TOMBSTONE: deleted */
+  uint32_t pid;
+  uint64_t last_used; /* CLOCK_REALTIME, ms */
+} MruSlot;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t slots;
+  MruSlot slot[MRU_SLOTS];
+} MruFile;
+
+static MruFile *mru_file = NULL;
+static int mru_tombstones = 0;
+
+static void mkdir_parents(char *path) {
+  for (char *p = path + 1; *p; ++p) {
+    if (*p != '/')
+      continue;
+    *p = 0;
+    mkdir(path, 0700);
+    *p = '/';
+  }
+}
+
+static void mru_file_open(void) {
+  char path[512];
+  const char *state = getenv("XDG_STATE_HOME");
+  const char *home = getenv("HOME");
+  if (state && state[0])
+    snprintf(path, sizeof(path), "%s/x11winch/mru", state);
+  else if (home && home[0])
+    snprintf(path, sizeof(path), "%s/.local/state/x11winch/mru", home);
+  else
+    return;
+  mkdir_parents(path);
+
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0)
+    return;
+  struct stat st;
+  if (fstat(fd, &st) < 0 ||
+      (st.st_size != sizeof(MruFile) && ftruncate(fd, sizeof(MruFile)) < 0)) {
+    close(fd);
+    return;
+  }
+  void *m = mmap(NULL, sizeof(MruFile), PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fd, 0);
+  close(fd);
+  if (m == MAP_FAILED)
+    return;
+  mru_file = m;
+  if (mru_file->magic != MRU_FILE_MAGIC || mru_file->slots != MRU_SLOTS) {
+    memset(mru_file, 0, sizeof(MruFile));
+    mru_file->magic = MRU_FILE_MAGIC;
+    mru_file->slots = MRU_SLOTS;
+  }
+  for (int i = 0; i < MRU_SLOTS; ++i)
+    if (mru_file->slot[i].win == MRU_TOMBSTONE)
+      mru_tombstones++;
+}
+
+static MruSlot *mru_slot(Window w, pid_t pid, int create) {
+  if (!mru_file || !w)
+    return NULL;
+  MruSlot *free_slot = NULL, *oldest = NULL;
+  size_t i = (size_t)(w * 2654435761u) & (MRU_SLOTS - 1);
+  for (int n = 0; n < MRU_SLOTS; ++n, i = (i + 1) & (MRU_SLOTS - 1)) {
+    MruSlot *sl = &mru_file->slot[i];
+    if (sl->win == 0) {
+      if (!free_slot)
+        free_slot = sl;
+      break;
+    }
+    if (sl->win == MRU_TOMBSTONE) {
+      if (!free_slot)
+        free_slot = sl;
+      continue;
+    }
+    if (sl->win == w) {
+      if (sl->pid == (uint32_t)pid)
+        return sl;
+      /* same id, different process: a stale entry from an old session */
+      if (!create)
+        return NULL;
+      free_slot = sl;
+      break;
+    }
+    if (!oldest || sl->last_used < oldest->last_used)
+      oldest = sl;
+  }
+  if (!create)
+    return NULL;
+  MruSlot *sl = free_slot ? free_slot : oldest;
+  if (sl->win == MRU_TOMBSTONE)
+    mru_tombstones--;
+  sl->win = w;
+  sl->pid = (uint32_t)pid;
+  sl->last_used = 0;
+  return sl;
+}
+
+/* empty the table and insert the given entries again */
+static void mru_rebuild(const MruSlot *keep, int n) {
+  memset(mru_file->slot, 0, sizeof(mru_file->slot));
+  mru_tombstones = 0;
+  for (int i = 0; i < n; ++i)
+    *mru_slot(keep[i].win, keep[i].pid, 1) = keep[i];
+}
+
+/* drop the tombstones once they make misses probe too far */
+static void mru_rehash(void) {
+  MruSlot *keep = malloc(sizeof(mru_file->slot));
+  if (!keep)
+    return;
+  int n = 0;
+  for (int i = 0; i < MRU_SLOTS; ++i) {
+    uint64_t w = mru_file->slot[i].win;
+    if (w && w != MRU_TOMBSTONE)
+      keep[n++] = mru_file->slot[i];
+  }
+  mru_rebuild(keep, n);
+  free(keep);
+}
+
+static void mru_record(Client *c) {
+  MruSlot *sl = mru_slot(c->win, c->pid, 1);
+  if (!sl)
+    return;
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  sl->last_used = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void mru_forget(Client *c) {
+  MruSlot *sl = mru_slot(c->win, c->pid, 0);
+  if (!sl)
+    return;
+  sl->win = MRU_TOMBSTONE;
+  if (++mru_tombstones > MRU_TOMBSTONES_MAX)
+    mru_rehash();
+}
+
+/* ---------- clients / MRU ---------- */
+
+/* errors caused by clients that vanished under a request are expected;
+   everything else goes to the handler that was installed before ours */
+static XErrorHandler prev_error_handler = NULL;
+static int damage_error_base = -1, render_error_base = -1;
+
+static int ignore_badwindow(Display *d, XErrorEvent *e) {
+  if (e->error_code == BadWindow || e->error_code == BadDrawable)
+    return 0;
+  if (damage_error_base >= 0 &&
+      e->error_code == damage_error_base + BadDamage)
+    return 0;
+  /* a thumbnail picture whose window was already gone */
+  if (render_error_base >= 0 &&
+      e->error_code == render_error_base + BadPicture)
+    return 0;
+  return prev_error_handler ? prev_error_handler(d, e) : 0;
+}
+
+static int window_wants_ignored(Window w) {
   Atom actual_type;
   int actual_format;
   unsigned long nitems, bytes_after;
   unsigned char *prop_ret = NULL;
   int has = 0;
 
-  if (!net_wm_state)
-    net_wm_state = XInternAtom(dpy, "_NET_WM_STATE", False);
-  if (!net_wm_state_skip_taskbar)
-    net_wm_state_skip_taskbar =
-        XInternAtom(dpy, "_NET_WM_STATE_SKIP_TASKBAR", False);
-
   if (Success == XGetWindowProperty(dpy, w, net_wm_state, 0, (~0L), False,
                                     AnyPropertyType, &actual_type,
                                     &actual_format, &nitems, &bytes_after,
@@ -469,81 +1206,625 @@ static int window_wants_ignored(Window w) {
   return has;
 }
 
-static void rebuild_client_list(void) {
-  client_count = 0;
+static int find_client(Window w) {
+  for (int i = 0; i < client_count; ++i)
+    if (clients[i].win == w)
+      return i;
+  return -1;
+}
+
+static int window_listed(const Window *wins, unsigned long n, Window w) {
+  for (unsigned long i = 0; i < n; ++i)
+    if (wins[i] == w)
+      return 1;
+  return 0;
+}
+
+static void invalidate_matches(void);
+static void grow_matches(int cap);
+
+/* copy the strings still referenced by clients into a fresh arena */
+static void compact_arena(void) {
+  char *old = arena;
+  arena = NULL;
+  arena_used = arena_cap = 0;
+  free(intern_tab);
+  intern_tab = NULL;
+  intern_cap = intern_count = 0;
+  for (int i = 0; i < client_count; ++i) {
+    clients[i].title = intern(old + clients[i].title);
+    clients[i].execname = intern(old + clients[i].execname);
+  }
+  for (int i = 0; i < proc_count; ++i)
+    procs[i].execname = intern(old + procs[i].execname);
+  free(old);
+  arena_compact_at = arena_used * 2 > ARENA_COMPACT_MIN ? arena_used * 2
+                                                       : ARENA_COMPACT_MIN;
+}
+
+/* refresh mru_pos[] and shown_rank[] after the client list changed */
+static void reindex_clients(void) {
+  invalidate_matches();
+  if (arena_used > arena_compact_at)
+    compact_arena();
+  int n = 0;
+  for (int k = 0; k < client_count; ++k) {
+    int r = mru[k];
+    mru_pos[r] = k;
+    shown_rank[r] = clients[r].valid ? ++n : 0;
+  }
+}
+
+static void grow_clients(void) {
+  int cap = client_cap ? client_cap * 2 : 64;
+  clients = realloc(clients, cap * sizeof(Client));
+  mru = realloc(mru, cap * sizeof(int));
+  mru_pos = realloc(mru_pos, cap * sizeof(int));
+  shown_rank = realloc(shown_rank, cap * sizeof(int));
+  if (!clients || !mru || !mru_pos || !shown_rank)
+    exit(2);
+  grow_matches(cap);
+  client_cap = cap;
+}
+
+static uint32_t window_title(Window w) {
+  char buf[MAX_LABEL];
+  get_window_title(w, buf, sizeof(buf));
+  return intern(buf);
+}
+
+/* ---------- batched client fetch ---------- */
+
+/* new clients are queried through XCB: every request for every new window
+   is sent before the first reply is awaited, so a scan costs about one
+   round trip however many windows appeared. Errors (windows that vanished
+   meanwhile) come back as NULL replies */
+typedef struct {
+  Window win;
+  xcb_get_window_attributes_cookie_t attrs;
+  xcb_get_geometry_cookie_t geom;
+  xcb_get_property_cookie_t net_name, name, pid, state;
+} ClientFetch;
+
+static Visual *visual_from_id(VisualID id) {
+  XVisualInfo tmpl, *vi;
+  int n = 0;
+  tmpl.visualid = id;
+  vi = XGetVisualInfo(dpy, VisualIDMask, &tmpl, &n);
+  if (!vi)
+    return NULL;
+  Visual *v = vi->visual;
+  XFree(vi);
+  return v;
+}
+
+static void fetch_send(ClientFetch *f, Window w) {
+  uint32_t mask =
+      XCB_EVENT_MASK_PROPERTY_CHANGE | XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+  f->win = w;
+  xcb_change_window_attributes(xcb, w, XCB_CW_EVENT_MASK, &mask);
+  f->attrs = xcb_get_window_attributes(xcb, w);
+  f->geom = xcb_get_geometry(xcb, w);
+  f->net_name = xcb_get_property(xcb, 0, w, net_wm_name,
+                                 XCB_GET_PROPERTY_TYPE_ANY, 0, MAX_LABEL / 4);
+  f->name = xcb_get_property(xcb, 0, w, XA_WM_NAME, XCB_GET_PROPERTY_TYPE_ANY,
+                             0, MAX_LABEL / 4);
+  f->pid = xcb_get_property(xcb, 0, w, net_wm_pid, XA_CARDINAL, 0, 1);
+  f->state = xcb_get_property(xcb, 0, w, net_wm_state, XA_ATOM, 0, 64);
+}
+
+static xcb_get_property_reply_t *prop_reply(xcb_get_property_cookie_t ck) {
+  xcb_generic_error_t *err = NULL;
+  xcb_get_property_reply_t *r = xcb_get_property_reply(xcb, ck, &err);
+  free(err);
+  return r;
+}
+
+/* copy a text property reply; returns 0 when it is missing or empty */
+static int prop_text(xcb_get_property_reply_t *r, char *buf, size_t bufsz) {
+  if (!r || r->format != 8)
+    return 0;
+  size_t len = xcb_get_property_value_length(r);
+  if (!len)
+    return 0;
+  if (len > bufsz - 1)
+    len = bufsz - 1;
+  memcpy(buf, xcb_get_property_value(r), len);
+  buf[len] = 0;
+  return 1;
+}
+
+/* collect the replies for one window and add it at the end of the MRU
+   order; every reply is consumed even when the window turned out gone */
+static int fetch_finish(ClientFetch *f) {
+  xcb_generic_error_t *err = NULL;
+  xcb_get_window_attributes_reply_t *wa =
+      xcb_get_window_attributes_reply(xcb, f->attrs, &err);
+  free(err);
+  err = NULL;
+  xcb_get_geometry_reply_t *geom = xcb_get_geometry_reply(xcb, f->geom, &err);
+  free(err);
+  xcb_get_property_reply_t *net_name = prop_reply(f->net_name);
+  xcb_get_property_reply_t *name = prop_reply(f->name);
+  xcb_get_property_reply_t *pid = prop_reply(f->pid);
+  xcb_get_property_reply_t *state = prop_reply(f->state);
+
+  int ok = wa && geom;
+  if (ok) {
+    if (client_count == client_cap)
+      grow_clients();
+    Client *c = &clients[client_count];
+    memset(c, 0, sizeof(*c));
+    c->win = f->win;
+    c->visual = visual_from_id(wa->visual);
+    c->viewable = wa->map_state == XCB_MAP_STATE_VIEWABLE;
+    c->w = geom->width;
+    c->h = geom->height;
+
+    /* skip-taskbar windows are remembered so they are not queried again */
+    c->valid = 1;
+    if (state && state->format == 32) {
+      xcb_atom_t *atoms = xcb_get_property_value(state);
+      int n = xcb_get_property_value_length(state) / 4;
+      for (int i = 0; i < n; ++i)
+        if (atoms[i] == net_wm_state_skip_taskbar)
+          c->valid = 0;
+    }
+
+    char title[MAX_LABEL];
+    if (!prop_text(net_name, title, sizeof(title)) &&
+        !prop_text(name, title, sizeof(title)))
+      snprintf(title, sizeof(title), "(untitled)");
+    c->title = intern(title);
+
+    if (pid && pid->format == 32 && xcb_get_property_value_length(pid) == 4) {
+      c->pid = *(uint32_t *)xcb_get_property_value(pid);
+      c->execname = proc_execname(c->pid);
+    } else {
+      c->execname = intern("unknown");
+    }
+    request_icon(c);
+    mru[client_count] = client_count;
+    client_count++;
+  }
+
+  free(wa);
+  free(geom);
+  free(net_name);
+  free(name);
+  free(pid);
+  free(state);
+  return ok;
+}
+
+/* release record r and mark it for compact_clients() */
+static void remove_client(int r) {
+  release_thumb(&clients[r]);
+  release_icon(&clients[r]);
+  mru_forget(&clients[r]);
+  clients[r].win = None;
+}
+
+/* drop the removed records in one pass, keeping the order of the others */
+static void compact_clients(void) {
+  int n = 0;
+  /* shown_rank is rebuilt by reindex_clients(); borrow it for old -> new */
+  for (int r = 0; r < client_count; ++r) {
+    if (clients[r].win == None) {
+      shown_rank[r] = -1;
+      continue;
+    }
+    shown_rank[r] = n;
+    if (n != r)
+      clients[n] = clients[r];
+    n++;
+  }
+  int m = 0;
+  for (int k = 0; k < client_count; ++k)
+    if (shown_rank[mru[k]] >= 0)
+      mru[m++] = shown_rank[mru[k]];
+  if (selected_index >= 0)
+    selected_index = shown_rank[selected_index];
+  client_count = n;
+  reindex_clients();
+}
+
+static void drop_client(Window w) {
+  int r = find_client(w);
+  if (r < 0)
+    return;
+  remove_client(r);
+  compact_clients();
+}
+
+/* listed windows whose fetch failed; not queried again until they leave
+   _NET_CLIENT_LIST or one of their properties changes */
+static Window *failed = NULL;
+static int failed_count = 0, failed_cap = 0;
+
+static int fetch_failed(Window w) {
+  for (int i = 0; i < failed_count; ++i)
+    if (failed[i] == w)
+      return 1;
+  return 0;
+}
+
+static void add_failed(Window w) {
+  if (failed_count == failed_cap) {
+    failed_cap = failed_cap ? failed_cap * 2 : 16;
+    failed = realloc(failed, failed_cap * sizeof(Window));
+    if (!failed)
+      exit(2);
+  }
+  failed[failed_count++] = w;
+}
+
+static int forget_failed(Window w) {
+  for (int i = 0; i < failed_count; ++i)
+    if (failed[i] == w) {
+      failed[i] = failed[--failed_count];
+      return 1;
+    }
+  return 0;
+}
+
+/* diff _NET_CLIENT_LIST against the known clients: drop the windows that
+   went away, query only the new ones, and keep the MRU order intact */
+static void sync_client_list(void) {
   Atom actual_type;
   int actual_format;
   unsigned long nitems, bytes_after;
   unsigned char *prop_ret = NULL;
 
-  if (Success == XGetWindowProperty(dpy, root, net_client_list, 0, (~0L), False,
+  if (Success != XGetWindowProperty(dpy, root, net_client_list, 0, (~0L), False,
                                     AnyPropertyType, &actual_type,
                                     &actual_format, &nitems, &bytes_after,
-                                    &prop_ret)) {
-    Window *wins = (Window *)prop_ret;
-    for (unsigned long i = 0; i < nitems && client_count < MAX_CLIENTS; ++i) {
-      Window w = wins[i];
-      XWindowAttributes wa;
-      if (!safe_attrs(dpy, w, &wa) || window_wants_ignored(w)) {
-        continue;
-      }
-      clients[client_count].win = w;
-      clients[client_count].valid = 1;
-      clients[client_count].pid = 0;
-      get_window_title(w, clients[client_count].title,
-                       sizeof(clients[client_count].title));
-      if (get_window_pid(w, &clients[client_count].pid)) {
-        read_proc_execname(clients[client_count].pid,
-                           clients[client_count].execname,
-                           sizeof(clients[client_count].execname));
-      } else {
-        snprintf(clients[client_count].execname,
-                 sizeof(clients[client_count].execname), "unknown");
-      }
-      snprintf(clients[client_count].label, sizeof(clients[client_count].label),
-               "%d. %s - %s", client_count + 1, clients[client_count].execname,
-               clients[client_count].title);
-      client_count++;
+                                    &prop_ret))
+    return;
+  Window *wins = (Window *)prop_ret;
+  if (!wins)
+    nitems = 0;
+
+  int removed = 0;
+  for (int r = 0; r < client_count; ++r) {
+    if (!window_listed(wins, nitems, clients[r].win)) {
+      remove_client(r);
+      removed = 1;
     }
-    if (prop_ret)
-      XFree(prop_ret);
   }
+  if (removed)
+    compact_clients();
+  for (int i = failed_count - 1; i >= 0; --i)
+    if (!window_listed(wins, nitems, failed[i]))
+      failed[i] = failed[--failed_count];
+
+  ClientFetch *fetch = nitems ? malloc(nitems * sizeof(ClientFetch)) : NULL;
+  int nfetch = 0;
+  if (fetch) {
+    for (unsigned long i = 0; i < nitems; ++i) {
+      if (find_client(wins[i]) < 0 && !fetch_failed(wins[i]))
+        fetch_send(&fetch[nfetch++], wins[i]);
+    }
+    for (int i = 0; i < nfetch; ++i)
+      if (!fetch_finish(&fetch[i]))
+        add_failed(fetch[i].win);
+    free(fetch);
+  }
+  if (prop_ret)
+    XFree(prop_ret);
+
+  if (selected_index < 0 && client_count)
+    selected_index = mru[0];
+  reindex_clients();
 }
 
-/* move window to front of MRU */
-static void mru_touch(Window w) {
+/* remember which cached field a PropertyNotify invalidated; the fields are
+   refetched once per event batch by refresh_stale_clients() */
+static void mark_stale(Window w, Atom atom) {
+  int i = find_client(w);
+  if (i < 0)
+    return;
+  if (atom == net_wm_name || atom == XA_WM_NAME)
+    clients[i].stale |= STALE_TITLE;
+  else if (atom == net_wm_pid)
+    clients[i].stale |= STALE_PID;
+  else if (atom == net_wm_state)
+    clients[i].stale |= STALE_STATE;
+  else if (atom == net_wm_icon)
+    clients[i].stale |= STALE_ICON;
+}
+
+/* refetch only the stale fields; returns 1 when a client changed */
+static int refresh_stale_clients(void) {
+  int changed = 0;
   for (int i = 0; i < client_count; ++i) {
-    if (clients[i].win == w) {
-      if (i == 0)
-        return;
-      Client tmp = clients[i];
-      memmove(&clients[1], &clients[0], sizeof(Client) * i);
-      clients[0] = tmp;
-      for (int j = 0; j < client_count; ++j) {
-        snprintf(clients[j].label, sizeof(clients[j].label), "%d. %s - %s",
-                 j + 1, clients[j].execname, clients[j].title);
-      }
-      return;
+    Client *c = &clients[i];
+    if (!c->stale)
+      continue;
+    if (c->stale & STALE_TITLE) {
+      c->title = window_title(c->win);
+      changed = 1;
+    }
+    if (c->stale & STALE_PID) {
+      c->pid = 0;
+      if (get_window_pid(c->win, &c->pid))
+        c->execname = proc_execname(c->pid);
+      else
+        c->execname = intern("unknown");
+      changed = 1;
+    }
+    if (c->stale & STALE_STATE) {
+      int valid = !window_wants_ignored(c->win);
+      changed |= valid != c->valid;
+      c->valid = valid;
     }
+    /* the new icon is picked up by collect_icons() once it arrives */
+    if (c->stale & STALE_ICON)
+      request_icon(c);
+    c->stale = 0;
   }
+  if (changed)
+    reindex_clients();
+  return changed;
 }
 
-static void create_overlays(void) {
-  int event_base, error_base;
-  int screens = 1;
+/* move window to front of MRU; only the permutation changes. A window
+   already at the front is not recorded again, so an activation we made
+   ourselves is not counted a second time when _NET_ACTIVE_WINDOW follows,
+   nor are repeated notifications for the same window. It is only stored
+   if the file has no entry for it yet, as after mru_restore */
+static void mru_touch(Window w) {
+  int r = find_client(w);
+  if (r < 0)
+    return;
+  if (mru_pos[r] == 0) {
+    if (!mru_slot(w, clients[r].pid, 0))
+      mru_record(&clients[r]);
+    return;
+  }
+  int p = mru_pos[r];
+  memmove(&mru[1], &mru[0], sizeof(int) * p);
+  mru[0] = r;
+  mru_record(&clients[r]);
+  reindex_clients();
+}
+
+static uint64_t *restore_keys = NULL;
+
+static int restore_cmp(const void *a, const void *b) {
+  uint64_t x = restore_keys[*(const int *)a], y = restore_keys[*(const int *)b];
+  if (x != y)
+    return x > y ? -1 : 1;
+  return mru_pos[*(const int *)a] - mru_pos[*(const int *)b];
+}
+
+/* order the clients found at startup by their persisted history, most
+   recent first; windows without history keep their _NET_CLIENT_LIST order.
+   Entries of windows that are gone are dropped and the table is rebuilt */
+static void mru_restore(void) {
+  if (!mru_file || !client_count)
+    return;
+  restore_keys = calloc(client_count, sizeof(uint64_t));
+  MruSlot *live = calloc(client_count, sizeof(MruSlot));
+  if (!restore_keys || !live) {
+    free(restore_keys);
+    free(live);
+    restore_keys = NULL;
+    return;
+  }
+  int nlive = 0;
+  for (int i = 0; i < client_count; ++i) {
+    MruSlot *sl = mru_slot(clients[i].win, clients[i].pid, 0);
+    if (!sl)
+      continue;
+    restore_keys[i] = sl->last_used;
+    live[nlive++] = *sl;
+  }
+  qsort(mru, client_count, sizeof(int), restore_cmp);
+  mru_rebuild(live, nlive);
+
+  free(live);
+  free(restore_keys);
+  restore_keys = NULL;
+  reindex_clients();
+}
+
+/* ---------- shrink animation ---------- */
+
+/* the animation runs off the main loop: every frame's geometry is derived
+   from the time elapsed on a monotonic clock, so input keeps flowing and a
+   slow frame does not stretch the whole animation */
+static int anim_running = 0;
+static double anim_start_ms = 0, anim_next_ms = 0;
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static void anim_frame(double now) {
+  double t = (now - anim_start_ms) / ANIM_TOTAL_MS;
+  if (t >= 1.0) {
+    anim_running = 0;
+    for (int o = 0; o < overlay_count; ++o)
+      XUnmapWindow(dpy, overlays[o].win);
+    XFlush(dpy);
+    return;
+  }
+
+  double f = 1.0 - t;
+  for (int o = 0; o < overlay_count; ++o) {
+    Overlay *ov = &overlays[o];
+    int nw = (int)(ov->w * f);
+    int nh = (int)(ov->h * f);
+    if (nw < 20)
+      nw = 20;
+    if (nh < 20)
+      nh = 20;
+    int nx = ov->x + (ov->w - nw) / 2;
+    int ny = ov->y + (ov->h - nh) / 2;
+
+    XMoveResizeWindow(dpy, ov->win, nx, ny, nw, nh);
+  }
+  XFlush(dpy);
+
+  /* next deadline on the fixed timeline, skipping frames we were late for */
+  int frame = (int)((now - anim_start_ms) * ANIM_STEPS / ANIM_TOTAL_MS) + 1;
+  anim_next_ms = anim_start_ms + (double)frame * ANIM_TOTAL_MS / ANIM_STEPS;
+}
+
+static void anim_tick(double now) {
+  if (anim_running && now >= anim_next_ms)
+    anim_frame(now);
+}
+
+/* ms until the next animation frame is due, -1 when idle */
+static int anim_timeout(double now) {
+  if (!anim_running)
+    return -1;
+  double left = anim_next_ms - now;
+  return left <= 0 ? 0 : (int)left + 1;
+}
+
+/* release the keyboard right away and shrink the overlays out; the windows
+   are unmapped by the last animation frame */
+static void hide_overlays(void) {
+  XUngrabKeyboard(dpy, CurrentTime);
+  overlay_visible = 0;
+  anim_running = 1;
+  anim_start_ms = now_ms();
+  anim_next_ms = anim_start_ms + (double)ANIM_TOTAL_MS / ANIM_STEPS;
+  XFlush(dpy);
+}
+
+/* ---------- overlay layers ---------- */
+
+/* rows are tall enough for a label or a thumbnail */
+static int row_pitch(Overlay *ov) {
+  int text_h = ov->xft_font->ascent + ov->xft_font->descent + 4;
+  return text_h > THUMB_H + 2 ? text_h : THUMB_H + 2;
+}
+
+static Picture scaled_picture(Pixmap src, unsigned sw, unsigned sh, int w,
+                              int h, Pixmap *out) {
+  XRenderPictFormat *fmt = XRenderFindStandardFormat(dpy, PictStandardARGB32);
+  *out = XCreatePixmap(dpy, root, w, h, 32);
+  Picture dst = XRenderCreatePicture(dpy, *out, fmt, 0, NULL);
+  XRenderColor clear = {0, 0, 0, 0};
+  XRenderFillRectangle(dpy, PictOpSrc, dst, &clear, 0, 0, w, h);
+  if (src && sw && sh) {
+    Picture p = XRenderCreatePicture(dpy, src, fmt, 0, NULL);
+    XTransform tr;
+    memset(&tr, 0, sizeof(tr));
+    tr.matrix[0][0] = XDoubleToFixed((double)sw / (double)w);
+    tr.matrix[1][1] = XDoubleToFixed((double)sh / (double)h);
+    tr.matrix[2][2] = XDoubleToFixed(1.0);
+    XRenderSetPictureTransform(dpy, p, &tr);
+    /* Use bilinear filtering for smoother scaling when available */
+    XRenderSetPictureFilter(dpy, p, "bilinear", NULL, 0);
+    XRenderComposite(dpy, PictOpSrc, p, None, dst, 0, 0, 0, 0, 0, 0, w, h);
+    XRenderFreePicture(dpy, p);
+  }
+  return dst;
+}
+
+/* the overlay size is fixed per layout, so everything that only depends on
+   it is scaled once here instead of on every draw */
+static void create_layers(Overlay *ov) {
+  XRenderPictFormat *fmt = XRenderFindStandardFormat(dpy, PictStandardARGB32);
+  if (!fmt)
+    return;
+
+  ov->base_picture = scaled_picture(shared_bg_pixmap, shared_bg_w, shared_bg_h,
+                                    ov->w, ov->h, &ov->base_pixmap);
+  if (shared_add_picture && shared_add_w && shared_add_h) {
+    int margin = 5;
+    int dest_w = (int)shared_add_w;
+    int dest_h = (int)shared_add_h;
+    int dest_x = ov->w - dest_w - margin;
+    int dest_y = ov->h - dest_h - margin;
+    if (dest_x < 0)
+      dest_x = 0;
+    if (dest_y < 0)
+      dest_y = 0;
+    /* No transform: draw source at its native size into dest rectangle */
+    XRenderComposite(dpy, PictOpOver, shared_add_picture, None,
+                     ov->base_picture, 0, 0, 0, 0, dest_x, dest_y, dest_w,
+                     dest_h);
+  }
+
+  ov->frame_pixmap = XCreatePixmap(dpy, root, ov->w, ov->h, 32);
+  ov->frame_picture =
+      XRenderCreatePicture(dpy, ov->frame_pixmap, fmt, 0, NULL);
+  ov->frame_draw = XftDrawCreate(dpy, ov->frame_pixmap, visual, colormap);
+
+  ov->selbar_picture =
+      scaled_picture(shared_sel_pixmap, shared_sel_w, shared_sel_h, ov->w - 10,
+                     row_pitch(ov), &ov->selbar_pixmap);
+
+  /* the selected label is drawn straight onto the window; keep it off the
+     border so a row repaint always covers it */
+  XRectangle inner = {1, 1, ov->w - 2, ov->h - 2};
+  XftDrawSetClipRectangles(ov->xft_draw, 0, 0, &inner, 1);
+
+  ov->rows_top = 20 + 10;
+  ov->rows_shown = (ov->h - ov->rows_top) / row_pitch(ov);
+}
+
+/* monitor rectangles the overlays were built for */
+static XRectangle layout_screens[SCREENS_MAX];
+static int layout_count = 0;
+
+/* current monitor rectangles; the whole root without Xinerama */
+static int query_screens(XRectangle *out) {
+  int event_base, error_base, n = 0;
   XineramaScreenInfo *info = NULL;
   if (XineramaQueryExtension(dpy, &event_base, &error_base) &&
-      XineramaIsActive(dpy)) {
-    info = XineramaQueryScreens(dpy, &screens);
+      XineramaIsActive(dpy))
+    info = XineramaQueryScreens(dpy, &n);
+  if (!info || n < 1) {
+    out[0].x = out[0].y = 0;
+    out[0].width = DisplayWidth(dpy, screen);
+    out[0].height = DisplayHeight(dpy, screen);
+    n = 1;
+  } else {
+    if (n > SCREENS_MAX)
+      n = SCREENS_MAX;
+    for (int i = 0; i < n; ++i) {
+      out[i].x = info[i].x_org;
+      out[i].y = info[i].y_org;
+      out[i].width = info[i].width;
+      out[i].height = info[i].height;
+    }
   }
+  if (info)
+    XFree(info);
+  return n;
+}
+
+/* monitors can be rearranged without resizing the root, which sends no
+   ConfigureNotify; compare against the layout on every show instead */
+static int layout_changed(void) {
+  XRectangle now[SCREENS_MAX];
+  int n = query_screens(now);
+  return n != layout_count ||
+         memcmp(now, layout_screens, n * sizeof(XRectangle)) != 0;
+}
+
+/* overlays are created once (and again only when the monitor layout
+   changes); showing them is then a map plus a repaint */
+static void create_overlays(void) {
+  int screens = query_screens(layout_screens);
+  layout_count = screens;
   overlay_count = screens;
   overlays = calloc(screens, sizeof(Overlay));
 
   for (int i = 0; i < screens; ++i) {
-    int sw = (info ? info[i].width : DisplayWidth(dpy, screen));
-    int sh = (info ? info[i].height : DisplayHeight(dpy, screen));
-    int sx = (info ? info[i].x_org : 0);
-    int sy = (info ? info[i].y_org : 0);
+    int sw = layout_screens[i].width;
+    int sh = layout_screens[i].height;
+    int sx = layout_screens[i].x;
+    int sy = layout_screens[i].y;
 
     int w = sw * 0.3;
     int h = sh * 0.3;
@@ -570,323 +1851,409 @@ static void create_overlays(void) {
     overlays[i].y = y;
     overlays[i].w = w;
     overlays[i].h = h;
-    overlays[i].bg_pixmap = shared_bg_pixmap;
-    overlays[i].bg_w = shared_bg_w;
-    overlays[i].bg_h = shared_bg_h;
-    overlays[i].bg_picture = 0;
     overlays[i].win_picture = 0;
 
-    if (shared_bg_pixmap) {
-      XRenderPictFormat *src_fmt =
-          XRenderFindStandardFormat(dpy, PictStandardARGB32);
-      if (src_fmt) {
-        overlays[i].bg_picture =
-            XRenderCreatePicture(dpy, shared_bg_pixmap, src_fmt, 0, NULL);
-      }
-      XRenderPictFormat *dst_fmt = XRenderFindVisualFormat(dpy, visual);
-      if (dst_fmt) {
-        overlays[i].win_picture =
-            XRenderCreatePicture(dpy, overlays[i].win, dst_fmt, 0, NULL);
-      }
-      /* create a shared picture for the selection image once */
-      if (shared_sel_pixmap && !shared_sel_picture) {
-        XRenderPictFormat *sel_fmt =
-            XRenderFindStandardFormat(dpy, PictStandardARGB32);
-        if (sel_fmt) {
-          shared_sel_picture =
-              XRenderCreatePicture(dpy, shared_sel_pixmap, sel_fmt, 0, NULL);
-        }
-      }
-      /* create a shared picture for the bottom-right add image once */
-      if (shared_add_pixmap && !shared_add_picture) {
-        XRenderPictFormat *add_fmt =
-            XRenderFindStandardFormat(dpy, PictStandardARGB32);
-        if (add_fmt) {
-          shared_add_picture =
-              XRenderCreatePicture(dpy, shared_add_pixmap, add_fmt, 0, NULL);
-        }
-      }
+    XRenderPictFormat *dst_fmt = XRenderFindVisualFormat(dpy, visual);
+    if (dst_fmt) {
+      overlays[i].win_picture =
+          XRenderCreatePicture(dpy, overlays[i].win, dst_fmt, 0, NULL);
     }
 
     set_font(&overlays[i]);
+    create_layers(&overlays[i]);
   }
+}
 
-  if (info)
-    XFree(info);
+static void destroy_overlays(void) {
+  for (int i = 0; i < overlay_count; ++i) {
+    Overlay *ov = &overlays[i];
+    if (ov->frame_draw)
+      XftDrawDestroy(ov->frame_draw);
+    if (ov->frame_picture)
+      XRenderFreePicture(dpy, ov->frame_picture);
+    if (ov->frame_pixmap)
+      XFreePixmap(dpy, ov->frame_pixmap);
+    if (ov->base_picture)
+      XRenderFreePicture(dpy, ov->base_picture);
+    if (ov->base_pixmap)
+      XFreePixmap(dpy, ov->base_pixmap);
+    if (ov->selbar_picture)
+      XRenderFreePicture(dpy, ov->selbar_picture);
+    if (ov->selbar_pixmap)
+      XFreePixmap(dpy, ov->selbar_pixmap);
+    if (ov->win_picture)
+      XRenderFreePicture(dpy, ov->win_picture);
+    if (ov->xft_draw) {
+      XftColorFree(dpy, visual, colormap, &ov->xft_color_text);
+      XftColorFree(dpy, visual, colormap, &ov->xft_color_sel);
+      XftDrawDestroy(ov->xft_draw);
+    }
+    if (ov->win)
+      XDestroyWindow(dpy, ov->win);
+  }
+  free(overlays);
+  overlays = NULL;
+  overlay_count = 0;
+  frame_valid = 0;
 }
 
 static void show_overlays(void) {
-  /* create windows each time overlays are shown */
-  create_overlays();
-
-  int event_base, error_base;
-  int screens = 1;
-  XineramaScreenInfo *info = NULL;
-  if (XineramaQueryExtension(dpy, &event_base, &error_base) &&
-      XineramaIsActive(dpy)) {
-    info = XineramaQueryScreens(dpy, &screens);
+  /* a new Alt+Tab cancels a shrink that is still running */
+  anim_running = 0;
+  if (layout_dirty || layout_changed()) {
+    destroy_overlays();
+    create_overlays();
+    layout_dirty = 0;
   }
 
   for (int i = 0; i < overlay_count; ++i) {
-    int sw = (info ? info[i].width : DisplayWidth(dpy, screen));
-    int sh = (info ? info[i].height : DisplayHeight(dpy, screen));
-    int sx = (info ? info[i].x_org : 0);
-    int sy = (info ? info[i].y_org : 0);
-    int w = sw * 0.3;
-    int h = sh * 0.3;
-    int x = sx + (sw - w) / 2;
-    int y = sy + (sh - h) / 2;
-
-    XMoveResizeWindow(dpy, overlays[i].win, x, y, w, h);
-    XMapRaised(dpy, overlays[i].win);
-
-    overlays[i].x = x;
-    overlays[i].y = y;
-    overlays[i].w = w;
-    overlays[i].h = h;
-
-    if (overlays[i].bg_picture && overlays[i].win_picture && shared_bg_w &&
-        shared_bg_h) {
-      XTransform tr;
-      double sx = (double)shared_bg_w / (double)w;
-      double sy = (double)shared_bg_h / (double)h;
-      memset(&tr, 0, sizeof(tr));
-      tr.matrix[0][0] = XDoubleToFixed(sx);
-      tr.matrix[1][1] = XDoubleToFixed(sy);
-      tr.matrix[2][2] = XDoubleToFixed(1.0);
-      XRenderSetPictureTransform(dpy, overlays[i].bg_picture, &tr);
-      /* Use bilinear filtering for smoother scaling when available */
-      XRenderSetPictureFilter(dpy, overlays[i].bg_picture, "bilinear", NULL, 0);
-
-      XRenderComposite(dpy, PictOpSrc, overlays[i].bg_picture, None,
-                       overlays[i].win_picture, 0, 0, 0, 0, 0, 0, overlays[i].w,
-                       overlays[i].h);
-    }
-    XFlush(dpy);
+    Overlay *ov = &overlays[i];
+    /* undo a previous shrink animation */
+    XMoveResizeWindow(dpy, ov->win, ov->x, ov->y, ov->w, ov->h);
+    XMapRaised(dpy, ov->win);
   }
 
   /* grab keyboard so Tab etc. go to us */
   XGrabKeyboard(dpy, root, True, GrabModeAsync, GrabModeAsync, CurrentTime);
 
   overlay_visible = 1;
-  selected_index = 0;
+  selected_index = client_count ? mru[0] : -1;
+}
 
-  if (info)
-    XFree(info);
+static void reset_filter(void) {
+  filter_text[0] = 0;
+  filter_len = 0;
 }
 
-static void hide_overlays(void) {
-  XUngrabKeyboard(dpy, CurrentTime);
-  /* destroy windows and free overlay structures so they are recreated next time
-   */
-  for (int i = 0; i < overlay_count; ++i) {
-    if (!overlays)
-      break;
-    if (overlays[i].win) {
-      XUnmapWindow(dpy, overlays[i].win);
-      if (overlays[i].bg_picture) {
-        XRenderFreePicture(dpy, overlays[i].bg_picture);
-        overlays[i].bg_picture = 0;
-      }
-      if (overlays[i].win_picture) {
-        XRenderFreePicture(dpy, overlays[i].win_picture);
-        overlays[i].win_picture = 0;
-      }
-      /* free shared selection picture once when tearing down overlays */
-      if (shared_sel_picture) {
-        XRenderFreePicture(dpy, shared_sel_picture);
-        shared_sel_picture = 0;
-      }
-      /* free shared add-picture once when tearing down overlays */
-      if (shared_add_picture) {
-        XRenderFreePicture(dpy, shared_add_picture);
-        shared_add_picture = 0;
-      }
-      XDestroyWindow(dpy, overlays[i].win);
-      overlays[i].win = 0;
-      // undo the opreations of set_font
-      if (overlays[i].ft_face) {
-        FT_Done_Face(overlays[i].ft_face);
-        overlays[i].ft_face = NULL;
-      }
-      if (overlays[i].ft_lib) {
-        FT_Done_FreeType(overlays[i].ft_lib);
-        overlays[i].ft_lib = NULL;
-      }
-      if (overlays[i].xft_font) {
-        XftFontClose(dpy, overlays[i].xft_font);
-        overlays[i].xft_font = NULL;
-      }
-    }
+/* ---------- filter matching ---------- */
+
+#define EXEC_BONUS 6
+#define MRU_BONUS_DEPTH 8
+
+typedef struct {
+  int idx;
+  int score;
+} Match;
+
+/* ranked matches for matched_filter, as indices into clients[] */
+static int *matches = NULL;
+static Match *ranked = NULL;
+static int match_count = 0;
+static int matches_valid = 0;
+static char matched_filter[FILTER_MAX];
+
+static void invalidate_matches(void) {
+  matches_valid = 0;
+  frame_valid = 0;
+}
+
+static void grow_matches(int cap) {
+  matches = realloc(matches, cap * sizeof(int));
+  ranked = realloc(ranked, cap * sizeof(Match));
+  if (!matches || !ranked)
+    exit(2);
+}
+
+static int client_score(int i, const char *needle) {
+  Client *c = &clients[i];
+  int e = fuzzy_score(str_at(c->execname), needle);
+  int t = fuzzy_score(str_at(c->title), needle);
+  int best = e >= 0 ? e + EXEC_BONUS : -1;
+  if (t > best)
+    best = t;
+  if (best < 0) {
+    /* allow a query to span execname and title, e.g. "ff gh" */
+    char both[EXEC_MAX + MAX_LABEL + 1];
+    snprintf(both, sizeof(both), "%s %s", str_at(c->execname),
+             str_at(c->title));
+    best = fuzzy_score(both, needle);
   }
-  free(overlays);
-  overlays = NULL;
-  overlay_count = 0;
-  overlay_visible = 0;
+  if (best < 0)
+    return -1;
+  /* recently used windows win ties */
+  if (mru_pos[i] < MRU_BONUS_DEPTH)
+    best += MRU_BONUS_DEPTH - mru_pos[i];
+  return best;
 }
 
-static void reset_filter(void) {
-  filter_text[0] = 0;
-  filter_len = 0;
+static int match_cmp(const void *a, const void *b) {
+  const Match *x = a, *y = b;
+  if (x->score != y->score)
+    return y->score - x->score;
+  return mru_pos[x->idx] - mru_pos[y->idx];
 }
 
-static int build_matches(int *out) {
+/* refresh matches[] for filter_text; when the filter only grew since the last
+   call, only the previous matches are rescored */
+static int build_matches(void) {
+  if (matches_valid && !strcmp(matched_filter, filter_text))
+    return match_count;
+
+  size_t prev_len = strlen(matched_filter);
+  int narrow = matches_valid && prev_len < (size_t)filter_len &&
+               !strncmp(matched_filter, filter_text, prev_len);
+  int cand_count = narrow ? match_count : client_count;
+
   int c = 0;
-  for (int i = 0; i < client_count; ++i) {
-    if (strcasestr_simple(clients[i].label, filter_text)) {
-      out[c++] = i;
+  for (int k = 0; k < cand_count; ++k) {
+    int i = narrow ? matches[k] : mru[k];
+    if (!clients[i].valid)
+      continue;
+    int score = client_score(i, filter_text);
+    if (score < 0)
+      continue;
+    ranked[c].idx = i;
+    ranked[c].score = score;
+    c++;
+  }
+  if (filter_len)
+    qsort(ranked, c, sizeof(Match), match_cmp);
+
+  for (int k = 0; k < c; ++k)
+    matches[k] = ranked[k].idx;
+  match_count = c;
+  strcpy(matched_filter, filter_text);
+  matches_valid = 1;
+  return match_count;
+}
+
+/* ---------- thumbnail refresh ---------- */
+
+static int shown_count(void) {
+  return match_count < MAX_ROWS ? match_count : MAX_ROWS;
+}
+
+/* render the thumbnails of the listed clients that changed, at most once
+   per THUMB_INTERVAL_MS each; unmapped clients keep their last thumbnail
+   until they are mapped again. Returns how many were rendered */
+static int refresh_thumbs(double now) {
+  int n = 0;
+  for (int i = 0; i < shown_count(); ++i) {
+    Client *c = &clients[matches[i]];
+    ensure_thumb(c, now);
+    if (c->viewable && c->thumb_dirty &&
+        now - c->thumb_ms >= THUMB_INTERVAL_MS) {
+      render_thumb(c, now);
+      n++;
     }
   }
-  return c;
+  return n;
+}
+
+/* ms until a listed thumbnail is due for a refresh, -1 when none is */
+static int thumb_timeout(double now) {
+  if (!overlay_visible)
+    return -1;
+  int best = -1;
+  for (int i = 0; i < shown_count(); ++i) {
+    Client *c = &clients[matches[i]];
+    if (!c->thumb_picture || !c->viewable || !c->thumb_dirty)
+      continue;
+    double left = c->thumb_ms + THUMB_INTERVAL_MS - now;
+    int ms = left <= 0 ? 0 : (int)left + 1;
+    if (best < 0 || ms < best)
+      best = ms;
+  }
+  return best;
+}
+
+static void on_damage(XDamageNotifyEvent *de) {
+  int i = find_client(de->drawable);
+  if (i < 0)
+    return;
+  clients[i].thumb_dirty = 1;
+  clients[i].w = de->geometry.width;
+  clients[i].h = de->geometry.height;
+}
+
+/* ---------- drawing ---------- */
+
+/* a full draw renders the frame layer and copies it to the window; moving
+   the selection then only repaints the old and the new row */
+
+static void row_label(int idx, char *buf, size_t bufsz) {
+  snprintf(buf, bufsz, "%d. %s - %s", shown_rank[idx],
+           str_at(clients[idx].execname), str_at(clients[idx].title));
+}
+
+static int row_count(Overlay *ov) {
+  int n = shown_count();
+  return n < ov->rows_shown ? n : ov->rows_shown;
+}
+
+/* row of the overlay showing client idx, -1 if it is not shown */
+static int row_of(Overlay *ov, int idx) {
+  for (int i = 0; i < row_count(ov); ++i)
+    if (matches[i] == idx)
+      return i;
+  return -1;
+}
+
+static int row_baseline(Overlay *ov, int row) {
+  int pitch = row_pitch(ov);
+  int text_off =
+      (pitch - (ov->xft_font->ascent + ov->xft_font->descent + 4)) / 2;
+  return ov->rows_top + row * pitch + text_off + ov->xft_font->ascent;
+}
+
+static void draw_thumb(Overlay *ov, Picture dst, int idx, int row) {
+  if (!clients[idx].thumb_picture || !dst)
+    return;
+  int pitch = row_pitch(ov);
+  XRenderComposite(dpy, PictOpOver, clients[idx].thumb_picture, None, dst, 0,
+                   0, 0, 0, ov->w - 10 - THUMB_W,
+                   ov->rows_top + row * pitch + (pitch - THUMB_H) / 2,
+                   THUMB_W, THUMB_H);
+}
+
+static void draw_icon(Overlay *ov, Picture dst, int idx, int row) {
+  if (!clients[idx].icon || !dst)
+    return;
+  int pitch = row_pitch(ov);
+  XRenderComposite(dpy, PictOpOver, icons[clients[idx].icon - 1].picture, None,
+                   dst, 0, 0, 0, 0, 10,
+                   ov->rows_top + row * pitch + (pitch - ICON_SIZE) / 2,
+                   ICON_SIZE, ICON_SIZE);
+}
+
+static void render_frame(Overlay *ov) {
+  XRenderComposite(dpy, PictOpSrc, ov->base_picture, None, ov->frame_picture,
+                   0, 0, 0, 0, 0, 0, ov->w, ov->h);
+
+  char filterline[256];
+  snprintf(filterline, sizeof(filterline), "filter: %s", filter_text);
+  XftDrawStringUtf8(ov->frame_draw, &ov->xft_color_text, ov->xft_font, 10, 20,
+                    (FcChar8 *)filterline, strlen(filterline));
+
+  for (int i = 0; i < row_count(ov); ++i) {
+    int idx = matches[i];
+    char txt[MAX_LABEL + EXEC_MAX + 16];
+    row_label(idx, txt, sizeof(txt));
+    XftDrawStringUtf8(ov->frame_draw, &ov->xft_color_text, ov->xft_font,
+                      LABEL_X, row_baseline(ov, i), (FcChar8 *)txt,
+                      strlen(txt));
+    draw_icon(ov, ov->frame_picture, idx, i);
+    draw_thumb(ov, ov->frame_picture, idx, i);
+  }
+  draw_gradient_border(ov->w, ov->h, dpy, ov->frame_pixmap);
+}
+
+/* repaint one row on the window, from the frame layer when unselected */
+static void paint_row(Overlay *ov, int row, int selected) {
+  if (row < 0 || !ov->win_picture)
+    return;
+  int pitch = row_pitch(ov);
+  int row_y = ov->rows_top + row * pitch;
+  if (!selected) {
+    XRenderComposite(dpy, PictOpSrc, ov->frame_picture, None, ov->win_picture,
+                     1, row_y, 0, 0, 1, row_y, ov->w - 2, pitch);
+    return;
+  }
+  int idx = matches[row];
+  XRenderComposite(dpy, PictOpSrc, ov->base_picture, None, ov->win_picture, 1,
+                   row_y, 0, 0, 1, row_y, ov->w - 2, pitch);
+  XRenderComposite(dpy, PictOpOver, ov->selbar_picture, None, ov->win_picture,
+                   0, 0, 0, 0, 5, row_y, ov->w - 10, pitch);
+  char txt[MAX_LABEL + EXEC_MAX + 16];
+  row_label(idx, txt, sizeof(txt));
+  XftDrawStringUtf8(ov->xft_draw, &ov->xft_color_sel, ov->xft_font,
+                    LABEL_X + 5, row_baseline(ov, row), (FcChar8 *)txt,
+                    strlen(txt));
+  draw_icon(ov, ov->win_picture, idx, row);
+  draw_thumb(ov, ov->win_picture, idx, row);
+}
+
+/* copy the frame layer to the window and mark the selection on top */
+static void present_overlay(Overlay *ov) {
+  if (!ov->win_picture)
+    return;
+  XRenderComposite(dpy, PictOpSrc, ov->frame_picture, None, ov->win_picture, 0,
+                   0, 0, 0, 0, 0, ov->w, ov->h);
+  paint_row(ov, row_of(ov, selected_index), 1);
+  XFlush(dpy);
 }
 
 static void draw_overlay_contents(void) {
   if (!overlay_visible)
     return;
 
-  int match_indices[MAX_CLIENTS];
-  int match_count = build_matches(match_indices);
+  build_matches();
+  refresh_thumbs(now_ms());
 
   int found = 0;
   for (int i = 0; i < match_count; ++i) {
-    if (match_indices[i] == selected_index) {
+    if (matches[i] == selected_index) {
       found = 1;
       break;
     }
   }
   if (!found) {
-    selected_index = match_indices[0];
+    selected_index = match_count ? matches[0] : -1;
   }
 
   for (int o = 0; o < overlay_count; ++o) {
-    Overlay *ov = &overlays[o];
-    if (ov->bg_picture && ov->win_picture && ov->bg_w && ov->bg_h) {
-      XTransform tr;
-      double sx = (double)ov->bg_w / (double)ov->w;
-      double sy = (double)ov->bg_h / (double)ov->h;
-      memset(&tr, 0, sizeof(tr));
-      tr.matrix[0][0] = XDoubleToFixed(sx);
-      tr.matrix[1][1] = XDoubleToFixed(sy);
-      tr.matrix[2][2] = XDoubleToFixed(1.0);
-      XRenderSetPictureTransform(dpy, ov->bg_picture, &tr);
-      /* Use bilinear filtering for smoother scaling when available */
-      XRenderSetPictureFilter(dpy, ov->bg_picture, "bilinear", NULL, 0);
-
-      XRenderComposite(dpy, PictOpSrc, ov->bg_picture, None, ov->win_picture, 0,
-                       0, 0, 0, 0, 0, ov->w, ov->h);
-    }
-
-    if (shared_add_picture && ov->win_picture && shared_add_w && shared_add_h) {
-      int margin = 5;
-      int dest_w = (int)shared_add_w;
-      int dest_h = (int)shared_add_h;
-      int dest_x = ov->w - dest_w - margin;
-      int dest_y = ov->h - dest_h - margin;
-      if (dest_x < 0)
-        dest_x = 0;
-      if (dest_y < 0)
-        dest_y = 0;
-      /* No transform: draw source at its native size into dest rectangle */
-      XRenderComposite(dpy, PictOpOver, shared_add_picture, None,
-                       ov->win_picture, 0, 0, 0, 0, dest_x, dest_y, dest_w,
-                       dest_h);
-    }
-
-    int y = 20;
-    char filterline[256];
-    snprintf(filterline, sizeof(filterline), "filter: %s", filter_text);
-    XftDrawStringUtf8(ov->xft_draw, &ov->xft_color_text, ov->xft_font, 10, y,
-                      (FcChar8 *)filterline, strlen(filterline));
-    y += ov->xft_font->ascent + 10;
-
-    int to_show = match_count < 15 ? match_count : 15;
-    for (int i = 0; i < to_show; ++i) {
-      int idx = match_indices[i];
-      char *txt = clients[idx].label;
-      int is_sel = (idx == selected_index);
-      int x = 10;
-      if (is_sel) {
-        int dest_x = 5;
-        int dest_y = y - ov->xft_font->ascent;
-        int dest_w = ov->w - 10;
-        int dest_h = ov->xft_font->ascent + ov->xft_font->descent + 4;
-        if (shared_sel_picture && ov->win_picture && shared_sel_w &&
-            shared_sel_h) {
-          /* set transform so source image scales to dest_w x dest_h */
-          XTransform tr;
-          double sx = (double)shared_sel_w / (double)dest_w;
-          double sy = (double)shared_sel_h / (double)dest_h;
-          memset(&tr, 0, sizeof(tr));
-          tr.matrix[0][0] = XDoubleToFixed(sx);
-          tr.matrix[1][1] = XDoubleToFixed(sy);
-          tr.matrix[2][2] = XDoubleToFixed(1.0);
-          XRenderSetPictureTransform(dpy, shared_sel_picture, &tr);
-          XRenderSetPictureFilter(dpy, shared_sel_picture, "bilinear", NULL, 0);
-          XRenderComposite(dpy, PictOpOver, shared_sel_picture, None,
-                           ov->win_picture, 0, 0, 0, 0, dest_x, dest_y, dest_w,
-                           dest_h);
-        }
-
-        XftDrawStringUtf8(ov->xft_draw, &ov->xft_color_sel, ov->xft_font, x + 5,
-                          y, (FcChar8 *)txt, strlen(txt));
-      } else {
-        XftDrawStringUtf8(ov->xft_draw, &ov->xft_color_text, ov->xft_font, x, y,
-                          (FcChar8 *)txt, strlen(txt));
-      }
-      y += ov->xft_font->ascent + ov->xft_font->descent + 4;
-    }
-    draw_gradient_border(ov->w, ov->h, dpy, ov->win);
-    XFlush(dpy);
+    render_frame(&overlays[o]);
+    present_overlay(&overlays[o]);
   }
+  frame_valid = 1;
 }
 
 static void select_next(int dir) {
-  int match_indices[MAX_CLIENTS];
-  int match_count = build_matches(match_indices);
-  if (match_count == 0)
+  int was_valid = frame_valid;
+  if (build_matches() == 0)
     return;
   int pos = 0;
   for (int i = 0; i < match_count; ++i) {
-    if (match_indices[i] == selected_index) {
+    if (matches[i] == selected_index) {
       pos = i;
       break;
     }
   }
+  int old = selected_index;
   pos = (pos + dir + match_count) % match_count;
-  selected_index = match_indices[pos];
-  draw_overlay_contents();
+  selected_index = matches[pos];
+  /* the frame still shows this match list, so only two rows change */
+  if (!was_valid || !frame_valid) {
+    draw_overlay_contents();
+    return;
+  }
+  for (int o = 0; o < overlay_count; ++o) {
+    Overlay *ov = &overlays[o];
+    paint_row(ov, row_of(ov, old), 0);
+    paint_row(ov, row_of(ov, selected_index), 1);
+  }
+  XFlush(dpy);
 }
 
-static void animate_shrink(void) {
-  const int steps = ANIM_STEPS;
-  const int sleep_us = ANIM_TOTAL_MS * 1000 / steps;
-
-  for (int s = 0; s < steps; ++s) {
-    double f = 1.0 - (double)(s + 1) / steps;
-    for (int o = 0; o < overlay_count; ++o) {
-      Overlay *ov = &overlays[o];
-      if (!ov || !ov->win)
-        continue;
-      XWindowAttributes xa;
-      if (!XGetWindowAttributes(dpy, ov->win, &xa))
-        continue;
-      if (xa.map_state == IsUnmapped)
-        continue;
-
-      int nw = (int)(ov->w * f);
-      int nh = (int)(ov->h * f);
-      if (nw < 20)
-        nw = 20;
-      if (nh < 20)
-        nh = 20;
-      int nx = ov->x + (ov->w - nw) / 2;
-      int ny = ov->y + (ov->h - nh) / 2;
-
-      XMoveResizeWindow(dpy, ov->win, nx, ny, nw, nh);
+/* ---------- event batching ---------- */
+
+/* event handlers only record what went stale; the main loop drains every
+   queued event first and then refreshes and repaints once per batch */
+static int clients_dirty = 0;
+static int active_dirty = 0;
+static int view_dirty = 0;
+
+static void flush_dirty(void) {
+  if (collect_icons())
+    view_dirty = 1;
+  if (clients_dirty) {
+    clients_dirty = 0;
+    sync_client_list();
+    view_dirty = 1;
+  }
+  if (active_dirty) {
+    active_dirty = 0;
+    Window aw = get_window_prop_window(root, net_active_window);
+    if (aw) {
+      mru_touch(aw);
+      view_dirty = 1;
     }
-    XSync(dpy, False);
-    usleep(sleep_us);
   }
+  if (refresh_stale_clients())
+    view_dirty = 1;
+  if (view_dirty && overlay_visible)
+    draw_overlay_contents();
+  view_dirty = 0;
 }
 
 static void activate_window(Window w) {
@@ -916,11 +2283,107 @@ static void activate_window(Window w) {
   }
 }
 
+/* ---------- quick tap ---------- */
+
+/* Alt+Tab grabs the keyboard but holds the overlay back for QUICK_TAP_MS.
+   Releasing Alt inside that window flips straight to the previous window
+   without mapping or painting anything */
+static double tap_deadline_ms = 0;
+
+static int tap_pending(void) { return tap_deadline_ms > 0; }
+
+/* Alt is still held: bring up the switcher as usual */
+static void tap_expand(void) {
+  tap_deadline_ms = 0;
+  show_overlays();
+  draw_overlay_contents();
+}
+
+static void tap_begin(void) {
+  reset_filter();
+  visible = 1;
+  /* without the grab we would never see Alt go up */
+  if (XGrabKeyboard(dpy, root, True, GrabModeAsync, GrabModeAsync,
+                    CurrentTime) != GrabSuccess) {
+    tap_expand();
+    return;
+  }
+  tap_deadline_ms = now_ms() + QUICK_TAP_MS;
+}
+
+static void tap_commit(void) {
+  tap_deadline_ms = 0;
+  XUngrabKeyboard(dpy, CurrentTime);
+  visible = 0;
+  flush_dirty();
+  /* the previous window the switcher would list; skip-taskbar records
+     are kept in the MRU but never shown */
+  for (int i = 1; i < client_count; ++i) {
+    if (!clients[mru[i]].valid)
+      continue;
+    Window w = clients[mru[i]].win;
+    activate_window(w);
+    mru_touch(w);
+    break;
+  }
+  XFlush(dpy);
+}
+
+static int alt_held(void) {
+  char keys[32];
+  XQueryKeymap(dpy, keys);
+  KeyCode codes[2] = {XKeysymToKeycode(dpy, XK_Alt_L),
+                      XKeysymToKeycode(dpy, XK_Alt_R)};
+  for (int i = 0; i < 2; ++i)
+    if (codes[i] && (keys[codes[i] >> 3] & (1 << (codes[i] & 7))))
+      return 1;
+  return 0;
+}
+
+static int tap_timeout(double now) {
+  if (!tap_pending())
+    return -1;
+  double left = tap_deadline_ms - now;
+  return left <= 0 ? 0 : (int)left + 1;
+}
+
+static void tap_tick(double now) {
+  if (!tap_pending() || now < tap_deadline_ms)
+    return;
+  /* Alt may have gone up before our grab took effect, in which case the
+     release went to the focused client and never reached us */
+  if (alt_held())
+    tap_expand();
+  else
+    tap_commit();
+}
+
+/* ---------- main loop timers ---------- */
+
+static int next_timeout(void) {
+  double now = now_ms();
+  int next = -1;
+  int t[3] = {anim_timeout(now), thumb_timeout(now), tap_timeout(now)};
+  for (int i = 0; i < 3; ++i)
+    if (t[i] >= 0 && (next < 0 || t[i] < next))
+      next = t[i];
+  return next;
+}
+
+static void run_timers(void) {
+  double now = now_ms();
+  anim_tick(now);
+  tap_tick(now);
+  if (thumb_timeout(now) == 0)
+    draw_overlay_contents();
+}
+
 int main(int argc, char **argv) {
   dpy = XOpenDisplay(NULL);
   if (!dpy)
     _exit(1);
 
+  xcb = XGetXCBConnection(dpy);
   screen = DefaultScreen(dpy);
   root = RootWindow(dpy, screen);
 
@@ -949,13 +2412,29 @@ int main(int argc, char **argv) {
   net_wm_name = XInternAtom(dpy, "_NET_WM_NAME", False);
   utf8_string = XInternAtom(dpy, "UTF8_STRING", False);
   net_wm_pid = XInternAtom(dpy, "_NET_WM_PID", False);
+  net_wm_state = XInternAtom(dpy, "_NET_WM_STATE", False);
+  net_wm_state_skip_taskbar =
+      XInternAtom(dpy, "_NET_WM_STATE_SKIP_TASKBAR", False);
+  net_wm_icon = XInternAtom(dpy, "_NET_WM_ICON", False);
 
   KeyCode tab_code = XKeysymToKeycode(dpy, XK_Tab);
   XGrabKey(dpy, tab_code, Mod1Mask, root, True, GrabModeAsync, GrabModeAsync);
 
+  /* clients can go away at any time; requests on them (thumbnails, damage)
+     fail asynchronously and must not take us down */
+  prev_error_handler = XSetErrorHandler(ignore_badwindow);
+
+  int composite_event, composite_error, damage_error, render_event;
+  if (XRenderQueryExtension(dpy, &render_event, &render_error_base) &&
+      XCompositeQueryExtension(dpy, &composite_event, &composite_error) &&
+      XDamageQueryExtension(dpy, &damage_event_base, &damage_error)) {
+    damage_error_base = damage_error;
+    have_thumbs = 1;
+  }
+
   XSelectInput(dpy, root,
-               SubstructureNotifyMask | PropertyChangeMask | KeyPressMask |
-                   KeyReleaseMask);
+               StructureNotifyMask | SubstructureNotifyMask |
+                   PropertyChangeMask | KeyPressMask | KeyReleaseMask);
 
   shared_bg_pixmap = load_png_to_pixmap_from_mem(
       dpy, root, bg_png, sizeof(bg_png), &shared_bg_w, &shared_bg_h);
@@ -965,119 +2444,187 @@ int main(int argc, char **argv) {
   shared_add_pixmap =
       load_png_to_pixmap_from_mem(dpy, root, bg_add_png, (size_t)bg_add_png_len,
                                   &shared_add_w, &shared_add_h);
-  rebuild_client_list();
+  XRenderPictFormat *argb_fmt =
+      XRenderFindStandardFormat(dpy, PictStandardARGB32);
+  if (shared_sel_pixmap && argb_fmt)
+    shared_sel_picture =
+        XRenderCreatePicture(dpy, shared_sel_pixmap, argb_fmt, 0, NULL);
+  if (shared_add_pixmap && argb_fmt)
+    shared_add_picture =
+        XRenderCreatePicture(dpy, shared_add_pixmap, argb_fmt, 0, NULL);
+  create_overlays();
+  mru_file_open();
+  sync_client_list();
+  mru_restore();
 
+  struct pollfd *pfds = NULL;
+  int pollfd_cap = 0;
   for (;;) {
-    XEvent ev;
-    XNextEvent(dpy, &ev);
-
-    switch (ev.type) {
-    case KeyPress: {
-      XKeyEvent *ke = &ev.xkey;
-      KeySym ks = XLookupKeysym(ke, 0);
-
-      if (ke->root == root && ks == XK_Tab && (ke->state & Mod1Mask) &&
-          !visible) {
-        reset_filter();
-        show_overlays();
-        draw_overlay_contents();
-        visible = 1;
-        break;
+    /* sleep until X has something for us, a watched process exits or the
+       next timer is due */
+    while (!XPending(dpy)) {
+      if (pollfd_cap < proc_count + 1) {
+        pollfd_cap = proc_count + 16;
+        pfds = realloc(pfds, pollfd_cap * sizeof(struct pollfd));
+        if (!pfds)
+          exit(2);
       }
+      pfds[0].fd = ConnectionNumber(dpy);
+      pfds[0].events = POLLIN;
+      pfds[0].revents = 0;
+      int n = 1 + proc_pollfds(pfds + 1);
+      if (poll(pfds, n, next_timeout()) > 0)
+        reap_procs(pfds + 1, n - 1);
+      /* icon replies wake us up without producing an X event */
+      if (collect_icons() && overlay_visible)
+        draw_overlay_contents();
+      run_timers();
+    }
 
-      if (overlay_visible) {
-        if (ks == XK_Escape) {
-          animate_shrink();
-          hide_overlays();
-          reset_filter();
-          visible = 0;
-        } else if (ks == XK_Return) {
-          animate_shrink();
-          hide_overlays();
-          activate_window(clients[selected_index].win);
-          mru_touch(clients[selected_index].win);
-          reset_filter();
-          visible = 0;
-        } else if (ks == XK_Tab && (ke->state & ShiftMask)) {
-          select_next(-1);
-        } else if (ks == XK_Tab) {
-          select_next(+1);
-        } else if (ks == XK_Down) {
-          select_next(+1);
-        } else if (ks == XK_Up) {
-          select_next(-1);
-        } else if (ks == XK_BackSpace) {
-          if (filter_len > 0) {
-            filter_text[--filter_len] = 0;
-            /* after filter changes, reset selection to first match */
-            int match_indices[MAX_CLIENTS];
-            int mc = build_matches(match_indices);
-            selected_index = match_indices[0];
-            draw_overlay_contents();
-          }
-        } else {
-          /* printable → filter */
-          char buf[8];
-          int n = XLookupString(ke, buf, sizeof(buf), NULL, NULL);
-          if (n > 0) {
-            for (int i = 0; i < n; ++i) {
-              if (filter_len < FILTER_MAX - 1 && buf[i] >= 32 && buf[i] < 127) {
-                filter_text[filter_len++] = buf[i];
-              }
-            }
-            filter_text[filter_len] = 0;
-            int match_indices[MAX_CLIENTS];
-            int mc = build_matches(match_indices);
-            if (mc == 0) {
-              selected_index = -1;
-              reset_filter();
-              draw_overlay_contents();
-            } else {
-              selected_index = match_indices[0];
+    /* drain everything that is queued before refreshing anything, so a
+       burst of unmaps and property changes costs one refresh */
+    do {
+      XEvent ev;
+      XNextEvent(dpy, &ev);
+
+      switch (ev.type) {
+      case KeyPress: {
+        /* keys act on an up-to-date client list */
+        flush_dirty();
+        XKeyEvent *ke = &ev.xkey;
+        KeySym ks = XLookupKeysym(ke, 0);
+
+        /* any further key while Alt is held means the user wants the list */
+        if (tap_pending()) {
+          if (IsModifierKey(ks))
+            break;
+          tap_expand();
+        }
+
+        if (ke->root == root && ks == XK_Tab && (ke->state & Mod1Mask) &&
+            !visible) {
+          tap_begin();
+          break;
+        }
+
+        if (overlay_visible) {
+          if (ks == XK_Escape) {
+            hide_overlays();
+            reset_filter();
+            visible = 0;
+          } else if (ks == XK_Return && selected_index >= 0) {
+            hide_overlays();
+            activate_window(clients[selected_index].win);
+            mru_touch(clients[selected_index].win);
+            reset_filter();
+            visible = 0;
+          } else if (ks == XK_Tab && (ke->state & ShiftMask)) {
+            select_next(-1);
+          } else if (ks == XK_Tab) {
+            select_next(+1);
+          } else if (ks == XK_Down) {
+            select_next(+1);
+          } else if (ks == XK_Up) {
+            select_next(-1);
+          } else if (ks == XK_BackSpace) {
+            if (filter_len > 0) {
+              filter_text[--filter_len] = 0;
+              /* after filter changes, reset selection to first match */
+              selected_index = build_matches() ? matches[0] : -1;
               draw_overlay_contents();
-              /* auto-select if only one */
-              if (mc == 1) {
-                animate_shrink();
-                hide_overlays();
-                activate_window(clients[selected_index].win);
-                mru_touch(clients[selected_index].win);
+            }
+          } else {
+            /* printable → filter */
+            char buf[8];
+            int n = XLookupString(ke, buf, sizeof(buf), NULL, NULL);
+            if (n > 0) {
+              for (int i = 0; i < n; ++i) {
+                if (filter_len < FILTER_MAX - 1 && buf[i] >= 32 &&
+                    buf[i] < 127) {
+                  filter_text[filter_len++] = buf[i];
+                }
+              }
+              filter_text[filter_len] = 0;
+              int mc = build_matches();
+              if (mc == 0) {
+                selected_index = -1;
                 reset_filter();
-                visible = 0;
+                draw_overlay_contents();
+              } else {
+                selected_index = matches[0];
+                draw_overlay_contents();
+                /* auto-select if only one */
+                if (mc == 1) {
+                  hide_overlays();
+                  activate_window(clients[selected_index].win);
+                  mru_touch(clients[selected_index].win);
+                  reset_filter();
+                  visible = 0;
+                }
               }
             }
           }
         }
-      }
 
-    } break;
-    case PropertyNotify: {
-      XPropertyEvent *pe = &ev.xproperty;
-      if (pe->window == root && pe->atom == net_client_list) {
-        rebuild_client_list();
-        if (overlay_visible)
-          draw_overlay_contents();
-      } else if (pe->window == root && pe->atom == net_active_window) {
-        Window aw = get_window_prop_window(root, net_active_window);
-        if (aw) {
-          mru_touch(aw);
-          if (overlay_visible)
-            draw_overlay_contents();
+      } break;
+      case KeyRelease: {
+        KeySym ks = XLookupKeysym(&ev.xkey, 0);
+        if (tap_pending() && (ks == XK_Alt_L || ks == XK_Alt_R))
+          tap_commit();
+      } break;
+      case PropertyNotify: {
+        XPropertyEvent *pe = &ev.xproperty;
+        if (pe->window == root && pe->atom == net_client_list) {
+          clients_dirty = 1;
+        } else if (pe->window == root && pe->atom == net_active_window) {
+          active_dirty = 1;
+        } else if (pe->window != root) {
+          /* a window whose fetch failed gets another chance */
+          if (forget_failed(pe->window))
+            clients_dirty = 1;
+          else
+            mark_stale(pe->window, pe->atom);
+        }
+      } break;
+      case Expose: {
+        if (overlay_visible && frame_valid) {
+          for (int o = 0; o < overlay_count; ++o)
+            if (overlays[o].win == ev.xexpose.window)
+              present_overlay(&overlays[o]);
+        } else {
+          view_dirty = 1;
         }
+      } break;
+      case ConfigureNotify: {
+        /* root resized: monitors were added, removed or rearranged */
+        if (ev.xconfigure.window == root)
+          layout_dirty = 1;
+      } break;
+      case MapNotify: {
+        int i = find_client(ev.xmap.window);
+        if (i >= 0) {
+          clients[i].viewable = 1;
+          clients[i].thumb_dirty = 1;
+        }
+      } break;
+      case DestroyNotify:
+        drop_client(ev.xdestroywindow.window);
+        /* fall through */
+      case UnmapNotify: {
+        int i = find_client(ev.xunmap.window);
+        if (i >= 0)
+          clients[i].viewable = 0;
+        clients_dirty = 1;
+      } break;
+      default:
+        if (have_thumbs && ev.type == damage_event_base + XDamageNotify)
+          on_damage((XDamageNotifyEvent *)&ev);
+        break;
       }
-    } break;
-    case Expose: {
-      if (overlay_visible)
-        draw_overlay_contents();
-    } break;
-    case DestroyNotify:
-    case UnmapNotify: {
-      rebuild_client_list();
-      if (overlay_visible)
-        draw_overlay_contents();
-    } break;
-    default:
-      break;
-    }
+    } while (XPending(dpy));
+
+    flush_dirty();
+    run_timers();
   }
 
   return 0;